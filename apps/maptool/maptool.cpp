@@ -1,9 +1,11 @@
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cmath>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <map>
 #include <sstream>
 #include <QtWidgets/qapplication.h>
@@ -11,19 +13,34 @@
 #include <QtCore/qdir.h>
 #include <QtCore/qfile.h>
 #include <QtCore/qfileinfo.h>
+#include <QtCore/qsavefile.h>
 #include <QtCore/qelapsedtimer.h>
 #include <QtGui/qimage.h>
 #include <QtGui/qpainter.h>
 #include <QtGui/qpainterpath.h>
 #include "ta/tdf.h"
+#include "ta/flattdf.h"
+#include "ta/lazytdf.h"
 #include "ta/palette.h"
 #include "nswf/nswfl_crc32.h"
 #include "rwe/tnt/TntArchive.h"
 #include "rwe/hpi/HpiArchive.h"
+#include "rwe/hpi/HpiArchiveRepository.h"
+#include "rwe/hpi/HpiContentCache.h"
+#include "rwe/hpi/hpi_cache_io.h"
+#include "rwe/hpi/HpiIndexCache.h"
+#include "rwe/hpi/HpiStreamBuf.h"
+#include "rwe/ThreadPool.h"
+#include <future>
+#include <mutex>
 #include <set>
 
 static bool VERBOSE = false;
-#define LOG_DEBUG(x) if (VERBOSE) { std::cout << x << std::endl; }
+
+// debug lines go to stderr, away from the listings on stdout, and are written whole so that workers' lines don't interleave
+static std::mutex logMutex;
+#define LOG_DEBUG(x) if (VERBOSE) { std::ostringstream logLine; logLine << x << '\n'; std::lock_guard<std::mutex> logLock(logMutex); std::cerr << logLine.str() << std::flush; }
+#define LOG_ERROR(x) { std::ostringstream logLine; logLine << x << '\n'; std::lock_guard<std::mutex> logLock(logMutex); std::cerr << logLine.str() << std::flush; }
 
 static std::string toLower(const std::string & s)
 {
@@ -32,47 +49,8 @@ static std::string toLower(const std::string & s)
     return lower;
 }
 
-struct HpiArchiveRepository
-{
-    struct Archive
-    {
-        std::shared_ptr<std::ifstream> fs;
-        std::shared_ptr<rwe::HpiArchive> hpi;
-        std::string hpiPath;
-    };
-
-    static std::map<std::string, Archive> m_archives;
-
-public:
-    static rwe::HpiArchive& get(std::string path)
-    {
-        try
-        {
-            Archive& archive = m_archives[path];
-            if (!archive.hpi)
-            {
-                archive.fs.reset(new std::ifstream(path, std::ios::binary));
-                if (!(*archive.fs))
-                {
-                    std::ostringstream ss;
-                    ss << "bad ifstream:" << archive.fs->rdstate() << ", errno:" << std::strerror(errno);
-                    throw std::runtime_error(ss.str());
-                }
-                archive.hpi.reset(new rwe::HpiArchive(archive.fs.get()));
-                archive.hpiPath = path;
-            }
-            return *archive.hpi;
-        }
-        catch (const std::exception& e)
-        {
-            std::ostringstream ss;
-            ss << e.what() << "(" << path << ", m_archive.size()=" << m_archives.size() << ")";
-            throw std::runtime_error(ss.str());
-        }
-    }
-};
-
-std::map<std::string, HpiArchiveRepository::Archive> HpiArchiveRepository::m_archives;
+// archives stay memory mapped, up to --maxopenarchives of them and --maxmappedmb of address space at a time
+static rwe::HpiArchiveRepository hpiRepository(64);
 
 struct HpiEntry
 {
@@ -82,17 +60,46 @@ struct HpiEntry
     std::shared_ptr<rwe::HpiArchive::File> file;
 };
 
+// extracted files (or just their CRCs) kept between runs, if --contentcachedir is given
+static std::unique_ptr<rwe::HpiContentCache> contentCache;
+
+rwe::HpiContentCache::Key contentCacheKey(const HpiEntry &entry)
+{
+    rwe::HpiArchiveRepository::Identity identity = hpiRepository.identity(entry.archivePath);
+    return rwe::HpiContentCache::Key(entry.archivePath, identity.size, identity.modificationTime, *entry.file);
+}
+
 std::string hpiLoad(const HpiEntry &entry)
 {
     LOG_DEBUG("[hpiLoad] " << entry.archivePath << ":" << entry.filePath);
 
     std::string data;
+    if (contentCache && contentCache->findData(contentCacheKey(entry), data))
+    {
+        LOG_DEBUG("[hpiLoad] " << entry.archivePath << ":" << entry.filePath << ", cached");
+        return data;
+    }
+
     {
-        rwe::HpiArchive& hpi = HpiArchiveRepository::get(entry.archivePath);
         LOG_DEBUG("[hpiLoad] " << entry.archivePath << ":" << entry.filePath << ", size=" << entry.file->size);
         data.resize(entry.file->size);
-        hpi.extract(*entry.file, const_cast<char*>(data.data()));
+        hpiRepository.extract(entry.archivePath, *entry.file, const_cast<char*>(data.data()));
     }
+    if (contentCache)
+    {
+        contentCache->insertData(contentCacheKey(entry), data.data(), data.size());
+    }
+    return data;
+}
+
+// as above, but large files are decompressed a chunk per worker
+std::string hpiLoad(const HpiEntry &entry, rwe::ThreadPool &pool)
+{
+    LOG_DEBUG("[hpiLoad] " << entry.archivePath << ":" << entry.filePath << ", size=" << entry.file->size);
+
+    std::string data;
+    data.resize(entry.file->size);
+    hpiRepository.extract(entry.archivePath, *entry.file, const_cast<char*>(data.data()), pool);
     return data;
 }
 
@@ -154,8 +161,8 @@ void HpiDirectory(
         try
         {
             std::string archivePath = gamePath + "/" + hpiFile.toStdString();
-            rwe::HpiArchive& hpi = HpiArchiveRepository::get(archivePath);
-            for (const rwe::HpiArchive::DirectoryEntry & hpiDirEntry: hpi.root().entries)
+            std::shared_ptr<const rwe::HpiArchive> hpi = hpiRepository.get(archivePath);
+            for (const rwe::HpiArchive::DirectoryEntry & hpiDirEntry: hpi->root().entries)
             {
                 if (hpiDirEntry.directory && 0 == QString::fromStdString(hpiDirEntry.name).compare(QString::fromStdString(hpiSubDir), Qt::CaseInsensitive))
                 {
@@ -170,16 +177,44 @@ void HpiDirectory(
         }
         catch (const std::exception & e)
         {
-            LOG_DEBUG("[HpiDirectory] " << e.what());
+            // its maps would otherwise just be missing from the listing
+            LOG_ERROR("unable to read archive " << gamePath << "/" << hpiFile.toStdString() << ": " << e.what());
         }
         catch (...)
         {
-            LOG_DEBUG("[HpiDirectory] general exception processing archive " << gamePath << "/" << hpiFile.toStdString());
+            LOG_ERROR("unable to read archive " << gamePath << "/" << hpiFile.toStdString());
         }
 
     }
 }
 
+// Open and index the archives matching hpiGlobSpec concurrently, so the (serial, order dependent)
+// HpiDirectory() calls that follow find them already parsed.
+void HpiPreload(const std::string& gamePath, const std::string& hpiGlobSpec, rwe::ThreadPool& pool)
+{
+    LOG_DEBUG("[HpiPreload] gamePath=" << gamePath << ", hpiGlobSpec=" << hpiGlobSpec);
+    QStringList hpiFiles = QDir(QString::fromStdString(gamePath)).entryList({ QString::fromStdString(hpiGlobSpec) }, QDir::Files, QDir::Name);
+
+    std::vector<std::future<void> > results;
+    for (QString hpiFile : hpiFiles)
+    {
+        std::string archivePath = gamePath + "/" + hpiFile.toStdString();
+        results.push_back(pool.submit([archivePath]() { hpiRepository.get(archivePath); }));
+    }
+
+    for (std::future<void>& result : results)
+    {
+        try
+        {
+            result.get();
+        }
+        catch (...)
+        {
+            // reported when HpiDirectory() retries the archive
+        }
+    }
+}
+
 QVector<QRgb> loadPalette(const std::string &paletteFile)
 {
     LOG_DEBUG("[loadPalette] paletteFile.size()=" << paletteFile.size());
@@ -325,55 +360,52 @@ void meanStdev(const std::vector<std::uint8_t>& data, double &mean, double &stde
     }
 }
 
-QImage createHeightMapImage(const rwe::TntArchive& tnt)
-{
-    const int width = tnt.getHeader().width;
-    const int height = tnt.getHeader().height;
-    LOG_DEBUG("[createHeightMapImage] tnt:" << width << 'x' << height);
-    std::vector<std::uint8_t> heights = readHeightMap(tnt);
+// The RGB colour for each tile height
+typedef std::array<std::array<std::uint8_t, 3>, 256> HeightColourTable;
 
-    QImage im(width, height, QImage::Format_RGB888);
-    im.fill(65535u);
-    for (int n=0; n<width*height; ++n)
-    {
-        int x = n % width;
-        int y = n / width;
-        std::uint8_t h = heights[n];
-        im.setPixel(x, y, qRgb(h, h, h));
-    }
-    return im;
+bool isWaterHeight(std::uint32_t seaLevel, std::uint8_t height)
+{
+    return seaLevel > 0 && height < seaLevel;
 }
 
-bool isWaterTile(const rwe::TntArchive& tnt, const rwe::TntTileAttributes& tileAttribute)
+// grey levels, and if there's a sea, the heights below it tinted blue
+HeightColourTable heightColourTable(std::uint32_t seaLevel, bool withWater)
 {
-    return tnt.getHeader().seaLevel > 0 && tileAttribute.height < tnt.getHeader().seaLevel;
+    HeightColourTable table;
+    for (int h = 0; h < 256; ++h)
+    {
+        if (withWater && isWaterHeight(seaLevel, h))
+        {
+            table[h] = { {
+                std::uint8_t((h * 175 + 35 * 80) / 255),
+                std::uint8_t((h * 175 + 90 * 80) / 255),
+                std::uint8_t((h * 175 + 210 * 80) / 255) } };
+        }
+        else
+        {
+            table[h] = { { std::uint8_t(h), std::uint8_t(h), std::uint8_t(h) } };
+        }
+    }
+    return table;
 }
 
-QImage createHeightMapWithWaterImage(const rwe::TntArchive& tnt)
+// Since a tile's colour only depends on its height, each pixel is one table lookup written straight into the scan line
+QImage renderHeightMap(int width, int height, const std::vector<rwe::TntTileAttributes>& tileAttributes, const HeightColourTable& colours)
 {
-    const int width = tnt.getHeader().width;
-    const int height = tnt.getHeader().height;
-    LOG_DEBUG("[createHeightMapWithWaterImage] tnt:" << width << 'x' << height);
-
-    QImage im = createHeightMapImage(tnt);
-    std::vector<rwe::TntTileAttributes> tileAttributes = readTileAttributes(tnt);
-
-    for (int n=0; n<width*height; ++n)
+    QImage im(width, height, QImage::Format_RGB888);
+    for (int y = 0; y < height; ++y)
     {
-        if (!isWaterTile(tnt, tileAttributes[n]))
+        const rwe::TntTileAttributes* row = &tileAttributes[std::size_t(y) * width];
+        std::uint8_t* line = im.scanLine(y);
+        for (int x = 0; x < width; ++x)
         {
-            continue;
+            const std::array<std::uint8_t, 3>& colour = colours[row[x].height];
+            line[0] = colour[0];
+            line[1] = colour[1];
+            line[2] = colour[2];
+            line += 3;
         }
-
-        int x = n % width;
-        int y = n / width;
-        QRgb base = im.pixel(x, y);
-        im.setPixel(x, y, qRgb(
-            (qRed(base) * 175 + 35 * 80) / 255,
-            (qGreen(base) * 175 + 90 * 80) / 255,
-            (qBlue(base) * 175 + 210 * 80) / 255));
     }
-
     return im;
 }
 
@@ -387,33 +419,181 @@ IteratorT findClosest(int x, int y, IteratorT beginNode, IteratorT endNode)
     });
 }
 
+// The node nearest to each point of a width x height raster, and/or the points that lie on the boundary between
+// two nodes' cells, as asked for, worked out for the whole raster in one pass.
+// There are only ever a handful of nodes (start positions), so each point simply tries them all with integer distances.
+// Points outside the raster, any point if the labels weren't asked for, and second nearest nodes
+// are found by scanning the nodes, which allocates nothing.
+// Ties go to the earlier node, as with findClosest()
+class VoronoiRaster
+{
+public:
+    enum Contents
+    {
+        Labels = 1u,
+        Boundaries = 2u
+    };
+
+private:
+    int width;
+    int height;
+    std::vector<std::pair<int, int> > nodes;
+    std::vector<std::uint16_t> labels;
+    std::vector<std::uint8_t> boundaries;
+
+    // keeps the nearest two of the squared distances offered, in order
+    static void consider(std::int64_t d2, std::size_t n, std::size_t& nearestNode, std::size_t& secondNode, std::int64_t& nearest, std::int64_t& secondNearest)
+    {
+        if (d2 < nearest)
+        {
+            secondNearest = nearest;
+            secondNode = nearestNode;
+            nearest = d2;
+            nearestNode = n;
+        }
+        else if (d2 < secondNearest)
+        {
+            secondNearest = d2;
+            secondNode = n;
+        }
+    }
+
+    void scan(int x, int y, std::size_t& nearestNode, std::size_t& secondNode, std::int64_t& nearest, std::int64_t& secondNearest) const
+    {
+        nearest = std::numeric_limits<std::int64_t>::max();
+        secondNearest = std::numeric_limits<std::int64_t>::max();
+        nearestNode = secondNode = 0u;
+        for (std::size_t n = 0u; n < nodes.size(); ++n)
+        {
+            std::int64_t dx = nodes[n].first - x;
+            std::int64_t dy = nodes[n].second - y;
+            consider(dx * dx + dy * dy, n, nearestNode, secondNode, nearest, secondNearest);
+        }
+    }
+
+public:
+    VoronoiRaster(int width, int height, const std::vector<std::pair<int, int> >& nodes, unsigned contents) :
+        width(std::max(width, 0)),
+        height(std::max(height, 0)),
+        nodes(nodes)
+    {
+        const bool doLabels = (contents & Labels) != 0u;
+        const bool doBoundaries = (contents & Boundaries) != 0u;
+        if (nodes.empty() || !(doLabels || doBoundaries))
+        {
+            return;
+        }
+        if (doLabels)
+        {
+            labels.resize(std::size_t(this->width) * this->height, 0u);
+        }
+        if (doBoundaries)
+        {
+            boundaries.resize(std::size_t(this->width) * this->height, 0u);
+        }
+
+        std::vector<std::int64_t> dy2(nodes.size());
+        for (int y = 0; y < this->height; ++y)
+        {
+            for (std::size_t n = 0u; n < nodes.size(); ++n)
+            {
+                std::int64_t dy = nodes[n].second - y;
+                dy2[n] = dy * dy;
+            }
+
+            std::size_t row = std::size_t(y) * this->width;
+            for (int x = 0; x < this->width; ++x)
+            {
+                std::int64_t nearest = std::numeric_limits<std::int64_t>::max();
+                std::int64_t secondNearest = std::numeric_limits<std::int64_t>::max();
+                std::size_t nearestNode = 0u, secondNode = 0u;
+                for (std::size_t n = 0u; n < nodes.size(); ++n)
+                {
+                    std::int64_t dx = nodes[n].first - x;
+                    consider(dx * dx + dy2[n], n, nearestNode, secondNode, nearest, secondNearest);
+                }
+
+                if (doLabels)
+                {
+                    labels[row + x] = std::uint16_t(nearestNode);
+                }
+                if (doBoundaries)
+                {
+                    boundaries[row + x] = nodes.size() > 1u && std::sqrt(double(secondNearest)) - std::sqrt(double(nearest)) < 1.415;
+                }
+            }
+        }
+    }
+
+    std::size_t nodeCount() const
+    {
+        return nodes.size();
+    }
+
+    // the index of the node nearest to (x, y), which may be outside the raster. There must be a node
+    std::size_t nearest(int x, int y) const
+    {
+        if (!labels.empty() && x >= 0 && y >= 0 && x < width && y < height)
+        {
+            return labels[std::size_t(y) * width + x];
+        }
+
+        std::size_t nearestNode, secondNode;
+        std::int64_t nearest, secondNearest;
+        scan(x, y, nearestNode, secondNode, nearest, secondNearest);
+        return nearestNode;
+    }
+
+    // as nearest(), along with the next nearest node. With just the one node, both are that
+    void nearestTwo(int x, int y, std::size_t& nearestNode, std::size_t& secondNode) const
+    {
+        std::int64_t nearest, secondNearest;
+        scan(x, y, nearestNode, secondNode, nearest, secondNearest);
+    }
+
+    double distance(std::size_t node, int x, int y) const
+    {
+        int dx = x - nodes[node].first;
+        int dy = y - nodes[node].second;
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    // whether (x, y) is within a pixel's diagonal of being as close to a second node as to its nearest.
+    // Always false unless the boundaries were asked for
+    bool isBoundary(int x, int y) const
+    {
+        return !boundaries.empty() && x >= 0 && y >= 0 && x < width && y < height && boundaries[std::size_t(y) * width + x] != 0u;
+    }
+};
+
 template<typename IteratorT>
 void voronoiLines(QImage& im, IteratorT beginNode, IteratorT endNode, QColor plotColor)
 {
     LOG_DEBUG("[voronoiLines]");
-    QPainter painter(&im);
-    for (int x = 0; x < im.width(); ++x)
+    VoronoiRaster cells(im.width(), im.height(), std::vector<std::pair<int, int> >(beginNode, endNode), VoronoiRaster::Boundaries);
+    std::vector<QPoint> points;
+    for (int y = 0; y < im.height(); ++y)
     {
-        for (int y = 0; y < im.height(); ++y)
+        for (int x = 0; x < im.width(); ++x)
         {
-            std::vector<double> distances;
-            std::transform(beginNode, endNode, std::back_inserter(distances), [x, y](const std::pair<int, int>& node) { return std::sqrt((node.first - x) * (node.first - x) + (node.second - y) * (node.second - y)); });
-            std::sort(distances.begin(), distances.end());
-            if (std::abs(distances[0]-distances[1]) < 1.415)
+            if (cells.isBoundary(x, y))
             {
-                painter.setPen(plotColor);
-                painter.drawPoint(x, y);
+                points.push_back(QPoint(x, y));
             }
         }
     }
+
+    QPainter painter(&im);
+    painter.setPen(plotColor);
+    painter.drawPoints(points.data(), int(points.size()));
 }
 
-bool isSkirmishMap(const ta::TdfFile& ota)
+bool isSkirmishMap(const ta::LazyTdfFile& ota)
 {
     // "proper" method.  requires parsing of tdf deeper than level 1
-    for (auto it = ota.children.begin(); it != ota.children.end(); ++it)
+    for (auto it = ota.children().begin(); it != ota.children().end(); ++it)
     {
-        for (auto childIt = it->second.children.begin(); childIt != it->second.children.end(); ++childIt)
+        for (auto childIt = it->second.children().begin(); childIt != it->second.children().end(); ++childIt)
         {
             try
             {
@@ -437,15 +617,15 @@ bool isSkirmishMap(const std::string& otaData)
     return QString(otaData.c_str()).contains("type=network", Qt::CaseInsensitive);
 }
 
-void lsMap(std::ostream& os, const std::string& context, const std::string &hpiArchive, const ta::TdfFile& ota, std::uint32_t crc)
+void lsMap(std::ostream& os, const std::string& context, const std::string &hpiArchive, const ta::LazyTdfFile& ota, std::uint32_t crc)
 {
     const char UNIT_SEPARATOR = '\x1f';
     const char RECORD_SEPARATOR = '\n';// '\x1e';
-    for (auto it = ota.children.begin(); it != ota.children.end(); ++it)
+    for (auto it = ota.children().begin(); it != ota.children().end(); ++it)
     {
         try
         {
-            auto tdfRootValues = it->second.values;
+            auto tdfRootValues = it->second.values();
             QFileInfo hpiFileInfo(hpiArchive.c_str());
 
             std::ostringstream ss;
@@ -499,13 +679,13 @@ std::ostream& operator<<(std::ostream& os, const QString& s)
     return os;
 }
 
-void sqlMap(std::ostream& os, const std::string& context, const std::string &hpiArchive, const ta::TdfFile& ota, std::uint32_t crc)
+void sqlMap(std::ostream& os, const std::string& context, const std::string &hpiArchive, const ta::LazyTdfFile& ota, std::uint32_t crc)
 {
     const int MAP_SIZE_SCALE_FACTOR = 1;
     try
     {
         std::ostringstream ss;
-        for (auto it = ota.children.begin(); it != ota.children.end(); ++it)
+        for (auto it = ota.children().begin(); it != ota.children().end(); ++it)
         {
             QFileInfo hpiFileInfo(hpiArchive.c_str());
             QStringList values;
@@ -517,9 +697,9 @@ void sqlMap(std::ostream& os, const std::string& context, const std::string &hpi
             ss << "ON DUPLICATE KEY UPDATE display_name=" << values[0] << ", map_type=" << values[1] << ", battle_type=" << values[2] << ";\n";
         }
 
-        for (auto it = ota.children.begin(); it != ota.children.end(); ++it)
+        for (auto it = ota.children().begin(); it != ota.children().end(); ++it)
         {
-            auto tdfRootValues = it->second.values;
+            auto tdfRootValues = it->second.values();
             QFileInfo hpiFileInfo(hpiArchive.c_str());
             QStringList values;
             values.append(sqlQuote(QString::fromStdString(tdfRootValues["missiondescription"])));
@@ -545,14 +725,14 @@ void sqlMap(std::ostream& os, const std::string& context, const std::string &hpi
 
 }
 
-const ta::TdfFile* getSchema(const ta::TdfFile& root, const std::string &type)
+const ta::LazyTdfFile* getSchema(const ta::LazyTdfFile& root, const std::string &type)
 {
-    LOG_DEBUG("[getSchema] values=" << root.values.size() << ", children=" << root.children.size() << ", type=" << type);
+    LOG_DEBUG("[getSchema] values=" << root.values().size() << ", children=" << root.children().size() << ", type=" << type);
     int schemaCount = std::atoi(root.getValue("schemacount", "0").c_str());
 
     for (int i = 0; i < schemaCount; ++i)
     {
-        const ta::TdfFile& schema = root.getChild("schema " + std::to_string(i));
+        const ta::LazyTdfFile& schema = root.getChild("schema " + std::to_string(i));
         if (schema.getValue("type", "").rfind(type) == 0) // aka startswith
         {
             return &schema;
@@ -561,17 +741,17 @@ const ta::TdfFile* getSchema(const ta::TdfFile& root, const std::string &type)
     return NULL;
 }
 
-std::vector< std::pair<int, int> > getSchemaStartingPositions(const ta::TdfFile& schema)
+std::vector< std::pair<int, int> > getSchemaStartingPositions(const ta::LazyTdfFile& schema)
 {
-    LOG_DEBUG("[getSchemaStartingPositions] values=" << schema.values.size() << ", children=" << schema.children.size());
+    LOG_DEBUG("[getSchemaStartingPositions] values=" << schema.values().size() << ", children=" << schema.children().size());
     int MAX_START_POSITIONS = 10;
     std::vector< std::pair<int, int> > startPositions(MAX_START_POSITIONS, std::pair<int,int>(0,0));
 
     int schemaStartPositions = 0;
     for (int nSpecial = 0;; ++nSpecial)
     {
-        const ta::TdfFile& special = schema.getChild("specials").getChild("special" + std::to_string(nSpecial));
-        if (special.values.empty())
+        const ta::LazyTdfFile& special = schema.getChild("specials").getChild("special" + std::to_string(nSpecial));
+        if (special.values().empty())
         {
             break;
         }
@@ -595,13 +775,13 @@ std::vector< std::pair<int, int> > getSchemaStartingPositions(const ta::TdfFile&
     return startPositions;
 }
 
-void appendSchemaFeatures(const ta::TdfFile& schema, std::vector< std::tuple<int, int, std::string> > &features)
+void appendSchemaFeatures(const ta::LazyTdfFile& schema, std::vector< std::tuple<int, int, std::string> > &features)
 {
-    LOG_DEBUG("[appendSchemaFeatures] values=" << schema.values.size() << ", children=" << schema.children.size() << ", features=" << features.size());
+    LOG_DEBUG("[appendSchemaFeatures] values=" << schema.values().size() << ", children=" << schema.children().size() << ", features=" << features.size());
     for (int nFeature = 0;; ++nFeature)
     {
-        const ta::TdfFile& feature = schema.getChild("features").getChild("feature" + std::to_string(nFeature));
-        if (feature.values.empty())
+        const ta::LazyTdfFile& feature = schema.getChild("features").getChild("feature" + std::to_string(nFeature));
+        if (feature.values().empty())
         {
             break;
         }
@@ -616,19 +796,19 @@ void appendSchemaFeatures(const ta::TdfFile& schema, std::vector< std::tuple<int
     }
 }
 
-const ta::TdfFile* getSchemaForPositionCount(const ta::TdfFile& ota, int positionCount, std::vector< std::pair<int,int> > *optionalStartingPositions)
+const ta::LazyTdfFile* getSchemaForPositionCount(const ta::LazyTdfFile& ota, int positionCount, std::vector< std::pair<int,int> > *optionalStartingPositions)
 {
-    LOG_DEBUG("[getSchemaForPositionCount] values=" << ota.values.size() << ", children=" << ota.children.size() << ", positionCount=" << positionCount << ", optionalStartingPositons=" << optionalStartingPositions);
+    LOG_DEBUG("[getSchemaForPositionCount] values=" << ota.values().size() << ", children=" << ota.children().size() << ", positionCount=" << positionCount << ", optionalStartingPositons=" << optionalStartingPositions);
     std::size_t sizeLargestSchema = 0;
-    const ta::TdfFile* largestSchema = NULL;
+    const ta::LazyTdfFile* largestSchema = NULL;
 
-    for (auto& pairRoot : ota.children)
+    for (auto& pairRoot : ota.children())
     {
         for (int nNetwork = 1;; ++nNetwork)
         {
             std::ostringstream ss;
             ss << "network " << nNetwork;
-            const ta::TdfFile* schema = getSchema(pairRoot.second, ss.str());
+            const ta::LazyTdfFile* schema = getSchema(pairRoot.second, ss.str());
             if (!schema)
             {
                 break;
@@ -657,31 +837,28 @@ const ta::TdfFile* getSchemaForPositionCount(const ta::TdfFile& ota, int positio
     return largestSchema;
 }
 
-std::vector< std::pair<int, int> > getStartingPositions(const ta::TdfFile &ota, int positionCount)
+std::vector< std::pair<int, int> > getStartingPositions(const ta::LazyTdfFile &ota, int positionCount)
 {
-    LOG_DEBUG("[getStartingPositions] values=" << ota.values.size() << ", children=" << ota.children.size() << ", positionCount=" << positionCount);
+    LOG_DEBUG("[getStartingPositions] values=" << ota.values().size() << ", children=" << ota.children().size() << ", positionCount=" << positionCount);
     std::vector< std::pair<int, int> > startPositions;
     getSchemaForPositionCount(ota, positionCount, &startPositions);
     return startPositions;
 }
 
-void appendOtaFileFeatures(const ta::TdfFile& ota, int positionCount, std::vector< std::tuple<int, int, std::string> > &features)
+void appendOtaFileFeatures(const ta::LazyTdfFile& ota, int positionCount, std::vector< std::tuple<int, int, std::string> > &features)
 {
     LOG_DEBUG("[appendOtaFileFeatures]");
-    const ta::TdfFile *schema = getSchemaForPositionCount(ota, positionCount, NULL);
+    const ta::LazyTdfFile *schema = getSchemaForPositionCount(ota, positionCount, NULL);
     if (schema)
     {
         appendSchemaFeatures(*schema, features);
     }
 }
 
-void appendTntFileFeatures(const rwe::TntArchive& tnt, std::vector< std::tuple<int, int, std::string> > &features)
+void appendTntFileFeatures(const rwe::TntArchive& tnt, const std::vector<rwe::TntTileAttributes>& tileAttributes, std::vector< std::tuple<int, int, std::string> > &features)
 {
     LOG_DEBUG("[appendTntFileFeatures]");
     int width = tnt.getHeader().width;
-    int height = tnt.getHeader().height;
-    std::vector<rwe::TntTileAttributes> tileAttributes(width * height);
-    tnt.readMapAttributes(tileAttributes.data());
 
     std::vector<std::string> mapFeatures;
     tnt.readFeatures([&mapFeatures](const std::string& featureName) {
@@ -701,7 +878,7 @@ void appendTntFileFeatures(const rwe::TntArchive& tnt, std::vector< std::tuple<i
     }
 }
 
-std::vector<std::tuple<int, int, int> > lookupFeatureValues(const std::vector< std::tuple<int, int, std::string> > &mapFeatures, const ta::TdfFile& featureLibrary, const std::string& matchKey, const std::string& matchValue, const std::string& valueKey)
+std::vector<std::tuple<int, int, int> > lookupFeatureValues(const std::vector< std::tuple<int, int, std::string> > &mapFeatures, const ta::FlatTdfFile& featureLibrary, const std::string& matchKey, const std::string& matchValue, const std::string& valueKey)
 {
     LOG_DEBUG("[lookupFeatureValues] matchKey=" << matchKey << ", matchValue=" << matchValue << ", valueKey=" << valueKey);
     std::vector<std::tuple<int, int, int> > matchingFeatureValues;
@@ -710,10 +887,10 @@ std::vector<std::tuple<int, int, int> > lookupFeatureValues(const std::vector< s
         int x = std::get<0>(featureTuple);
         int y = std::get<1>(featureTuple);
         const std::string& featureName = std::get<2>(featureTuple);
-        const ta::TdfFile& featureData = featureLibrary.getChild(featureName);
-        if (featureData.getValue(matchKey, "") == matchValue)
+        ta::FlatTdfFile::Node featureData = featureLibrary.getChild(featureName);
+        if (featureData.getValueView(matchKey, "") == matchValue)
         {
-            std::string valueString = featureData.getValue(valueKey, "");
+            std::string valueString(featureData.getValueView(valueKey, ""));
             if (!valueString.empty())
             {
                 int value = std::atoi(valueString.c_str());
@@ -724,10 +901,14 @@ std::vector<std::tuple<int, int, int> > lookupFeatureValues(const std::vector< s
     return matchingFeatureValues;
 }
 
-std::vector<int> voronoiAccumulateFeatures(const std::vector<std::tuple<int, int, int> > &featuresXYValue, const std::vector<std::pair<int, int> >& nodes)
+std::vector<int> voronoiAccumulateFeatures(const std::vector<std::tuple<int, int, int> > &featuresXYValue, const std::vector<std::pair<int, int> >& nodes, const VoronoiRaster& cells)
 {
     LOG_DEBUG("[voronoiAccumulateFeatures]");
     std::vector<int> areaValues(nodes.size(), 0);
+    if (nodes.empty())
+    {
+        return areaValues;
+    }
 
     for (const std::pair<int, int> &xyVal : nodes)
     {
@@ -739,7 +920,7 @@ std::vector<int> voronoiAccumulateFeatures(const std::vector<std::tuple<int, int
         int x = std::get<0>(xyVal);
         int y = std::get<1>(xyVal);
         int val = std::get<2>(xyVal);
-        std::size_t closestNode = std::distance(nodes.begin(), findClosest(x, y, nodes.begin(), nodes.end()));
+        std::size_t closestNode = cells.nearest(x, y);
         LOG_DEBUG("  node=" << closestNode << " x=" << x << " y=" << y << " val=" << val);
         areaValues[closestNode] += val;
     }
@@ -751,10 +932,14 @@ std::vector<int> voronoiAccumulateFeatures(const std::vector<std::tuple<int, int
     return areaValues;
 }
 
-std::vector<double> weightedVoronoiAccumulateFeatures(const std::vector<std::tuple<int, int, int> >& featuresXYValue, const std::vector<std::pair<int, int> >& nodes)
+std::vector<double> weightedVoronoiAccumulateFeatures(const std::vector<std::tuple<int, int, int> >& featuresXYValue, const VoronoiRaster& cells)
 {
     LOG_DEBUG("[weightedVoronoiAccumulateFeatures]");
-    std::vector<double> sumValues(nodes.size(), 0);
+    std::vector<double> sumValues(cells.nodeCount(), 0);
+    if (cells.nodeCount() == 0u)
+    {
+        return sumValues;
+    }
 
     for (const std::tuple<int, int, int>& xyVal : featuresXYValue)
     {
@@ -762,18 +947,17 @@ std::vector<double> weightedVoronoiAccumulateFeatures(const std::vector<std::tup
         int y = std::get<1>(xyVal);
         int val = std::get<2>(xyVal);
 
-        std::multimap<double, std::size_t> nodesByDistance;
-        for (std::size_t nNode=0u; nNode<nodes.size(); ++nNode)
+        std::size_t nClosestNode, nSecondClosestNode;
+        cells.nearestTwo(x, y, nClosestNode, nSecondClosestNode);
+
+        // a lone node takes everything, as if the next were infinitely far away
+        double weight = 1.0;
+        if (cells.nodeCount() > 1u)
         {
-            int dx = x - std::get<0>(nodes[nNode]);
-            int dy = y - std::get<1>(nodes[nNode]);
-            double d = std::sqrt(dx * dx + dy * dy);
-            nodesByDistance.insert(std::pair<double, std::size_t>(d, nNode));
+            double dClosestNode = cells.distance(nClosestNode, x, y);
+            double dSecondClosestNode = cells.distance(nSecondClosestNode, x, y);
+            weight = (dSecondClosestNode - dClosestNode)/dSecondClosestNode;
         }
-        std::size_t nClosestNode = nodesByDistance.begin()->second;
-        double dClosestNode = nodesByDistance.begin()->first;
-        double dSecondClosestNode = (std::next(nodesByDistance.begin()))->first;
-        double weight = (dSecondClosestNode - dClosestNode)/dSecondClosestNode;
         weight = std::sin(3.141592654 * weight /2.0);
         sumValues[nClosestNode] += val * weight;
     }
@@ -821,9 +1005,109 @@ void drawText(QPainter& painter, int x, int y, int size, QString text, Qt::Globa
     painter.drawPath(path);
 }
 
+// Everything the previews are drawn from, decoded from the map's .tnt and .ota once and then shared by every preview type.
+// Coordinates are in tile attribute units (16 pixels), as in the .tnt.
+// Once built it is only read, so unlike the TntArchive and LazyTdfFile it came from, it can be shared by previews rendered concurrently.
+// Only what the requested preview types use is filled in.
+struct MapModel
+{
+    int width;
+    int height;
+    std::uint32_t seaLevel;
+    QImage miniMap;                                             // indexed, without its palette
+    std::vector<rwe::TntTileAttributes> tileAttributes;
+    QImage heightMap;                                           // one pixel per tile attribute
+    std::vector<std::pair<int, int> > startPositions;           // of the schema best matching maxPositions, perhaps more than that
+    std::vector<std::tuple<int, int, std::string> > features;   // of the .tnt and that schema
+    std::unique_ptr<VoronoiRaster> owners;                      // which of the first maxPositions start positions each tile is nearest, labelled only if that pays
+    std::vector<std::uint16_t> tileIndices;                     // (width/2) x (height/2) 32 pixel tiles, indexing tileGraphics
+    std::vector<std::uint8_t> tileGraphics;                     // 32x32 palette indices per tile
+};
+
+bool isResourcePreviewType(const QString& type)
+{
+    static const QStringList resourceTypes = { "mexes", "geos", "rocks", "trees" };
+    return resourceTypes.contains(type.endsWith("-overlay") ? type.left(type.size() - 8) : type);
+}
+
+MapModel decodeMap(rwe::TntArchive& tnt, const ta::LazyTdfFile& ota, const QStringList& types, int maxPositions)
+{
+    LOG_DEBUG("[decodeMap] maxPositions=" << maxPositions);
+    MapModel model;
+    model.width = tnt.getHeader().width;
+    model.height = tnt.getHeader().height;
+    model.seaLevel = tnt.getHeader().seaLevel;
+
+    bool needMiniMap = false, needTileAttributes = false, needHeightMap = false, needPositions = false, needFeatures = false;
+    bool needTiles = types.contains("tiles");
+    std::size_t resourceTypeCount = 0u;
+    for (const QString& type : types)
+    {
+        bool resources = isResourcePreviewType(type);
+        resourceTypeCount += resources ? 1u : 0u;
+        needMiniMap |= type == "mini" || type == "positions";
+        needHeightMap |= type == "heightmap" || (resources && !type.endsWith("-overlay"));
+        needTileAttributes |= needHeightMap || type == "heightmap-water" || resources;
+        needPositions |= type.startsWith("positions") || resources;
+        needFeatures |= resources;
+    }
+
+    if (needMiniMap)
+    {
+        model.miniMap = readMiniMap(tnt);
+    }
+    if (needTileAttributes)
+    {
+        model.tileAttributes = readTileAttributes(tnt);
+    }
+    if (needHeightMap)
+    {
+        model.heightMap = renderHeightMap(model.width, model.height, model.tileAttributes, heightColourTable(model.seaLevel, false));
+    }
+    if (needPositions)
+    {
+        model.startPositions = getStartingPositions(ota, maxPositions);
+    }
+    if (needFeatures)
+    {
+        appendTntFileFeatures(tnt, model.tileAttributes, model.features);
+        for (auto& tup : model.features)
+        {
+            LOG_DEBUG("Tnt features:" << std::get<0>(tup) << ',' << std::get<1>(tup) << ',' << std::get<2>(tup));
+        }
+        appendOtaFileFeatures(ota, maxPositions, model.features);
+        for (auto& tup : model.features)
+        {
+            LOG_DEBUG("Tnt+Ota features:" << std::get<0>(tup) << ',' << std::get<1>(tup) << ',' << std::get<2>(tup));
+        }
+
+        // Labelling every tile costs as much as scanning the start positions for that many features,
+        // so it only pays when the resource previews look up more features than there are tiles
+        std::vector<std::pair<int, int> > owners(model.startPositions.begin(), model.startPositions.begin() + std::min<std::size_t>(model.startPositions.size(), std::max(maxPositions, 0)));
+        bool labelTiles = resourceTypeCount * model.features.size() > std::size_t(model.width) * std::size_t(model.height);
+        model.owners.reset(new VoronoiRaster(model.width, model.height, owners, labelTiles ? VoronoiRaster::Labels : 0u));
+    }
+    if (needTiles)
+    {
+        model.tileIndices.resize(std::size_t(model.width / 2) * (model.height / 2));
+        tnt.readMapData(model.tileIndices.data());
+        model.tileGraphics.reserve(std::size_t(tnt.getHeader().numberOfTiles) * 32u * 32u);
+        tnt.readTiles([&model](const char* tile)
+        {
+            model.tileGraphics.insert(model.tileGraphics.end(), tile, tile + 32 * 32);
+        });
+    }
+    return model;
+}
+
+// a nominalSize of 0 leaves the image as drawn
 double resize(QImage& im, int nominalSize)
 {
     LOG_DEBUG("[resize(QImage)]");
+    if (nominalSize <= 0)
+    {
+        return 1.0;
+    }
     int currentSize = std::max(im.width(), im.height());
     double scale = double(nominalSize) / double(currentSize);
 
@@ -831,11 +1115,15 @@ double resize(QImage& im, int nominalSize)
     return scale;
 }
 
-double resizeToMapDimensions(QImage& im, const rwe::TntArchive& tnt, int nominalSize)
+double resizeToMapDimensions(QImage& im, const MapModel& map, int nominalSize)
 {
     LOG_DEBUG("[resizeToMapDimensions(QImage)]");
-    int mapWidth = tnt.getHeader().width;
-    int mapHeight = tnt.getHeader().height;
+    if (nominalSize <= 0)
+    {
+        return 1.0;
+    }
+    int mapWidth = map.width;
+    int mapHeight = map.height;
     int currentSize = std::max(mapWidth, mapHeight);
     double scale = double(nominalSize) / double(currentSize);
 
@@ -843,19 +1131,180 @@ double resizeToMapDimensions(QImage& im, const rwe::TntArchive& tnt, int nominal
     return scale;
 }
 
-QImage createPositionsMapImage(const rwe::TntArchive& tnt, const ta::TdfFile& ota, QVector<uint> palette, int positionCount, int nominalSize)
+// For shrinking srcSize pixels to outSize by area averaging: the output pixel each source pixel lands in,
+// so that each output pixel is the mean of an unbroken run of source pixels
+std::vector<int> areaTargets(int srcSize, int outSize)
+{
+    std::vector<int> targets(std::max(srcSize, 0));
+    for (int n = 0; n < srcSize; ++n)
+    {
+        targets[n] = int(std::int64_t(n) * outSize / srcSize);
+    }
+    return targets;
+}
+
+// Shrinks im to nominalSize across by averaging the block of source pixels under each output pixel.
+// Much faster than QImage::scaled(Qt::SmoothTransformation), and as each level of a pyramid is made from the one above,
+// just as good. Alpha is averaged premultiplied, so the transparent parts of overlays don't bleed into their edges.
+QImage downscale(const QImage& im, int nominalSize)
+{
+    const int srcWidth = im.width();
+    const int srcHeight = im.height();
+    if (im.isNull() || nominalSize <= 0 || nominalSize >= std::max(srcWidth, srcHeight))
+    {
+        return im;
+    }
+    LOG_DEBUG("[downscale] " << srcWidth << 'x' << srcHeight << ", nominalSize=" << nominalSize);
+
+    double scale = double(nominalSize) / double(std::max(srcWidth, srcHeight));
+    const int outWidth = std::max(1, int(scale * double(srcWidth) + 0.5));
+    const int outHeight = std::max(1, int(scale * double(srcHeight) + 0.5));
+
+    const std::vector<int> outX = areaTargets(srcWidth, outWidth);
+    const std::vector<int> outY = areaTargets(srcHeight, outHeight);
+    std::vector<std::uint32_t> columnCounts(outWidth, 0u);
+    for (int x : outX)
+    {
+        ++columnCounts[x];
+    }
+
+    const QImage src = im.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage out(outWidth, outHeight, QImage::Format_ARGB32_Premultiplied);
+    std::vector<std::uint32_t> sums(std::size_t(outWidth) * 4u, 0u);
+    std::uint32_t rows = 0u;
+    for (int y = 0; y < srcHeight; ++y)
+    {
+        const QRgb* pixels = reinterpret_cast<const QRgb*>(src.constScanLine(y));
+        for (int x = 0; x < srcWidth; ++x)
+        {
+            std::uint32_t* sum = &sums[std::size_t(outX[x]) * 4u];
+            sum[0] += qRed(pixels[x]);
+            sum[1] += qGreen(pixels[x]);
+            sum[2] += qBlue(pixels[x]);
+            sum[3] += qAlpha(pixels[x]);
+        }
+        ++rows;
+
+        if (y + 1 == srcHeight || outY[y + 1] != outY[y])
+        {
+            QRgb* line = reinterpret_cast<QRgb*>(out.scanLine(outY[y]));
+            for (int x = 0; x < outWidth; ++x)
+            {
+                const std::uint32_t count = columnCounts[x] * rows;
+                const std::uint32_t* sum = &sums[std::size_t(x) * 4u];
+                line[x] = qRgba((sum[0] + count / 2u) / count, (sum[1] + count / 2u) / count, (sum[2] + count / 2u) / count, (sum[3] + count / 2u) / count);
+            }
+            std::fill(sums.begin(), sums.end(), 0u);
+            rows = 0u;
+        }
+    }
+    return out.convertToFormat(im.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB888);
+}
+
+// The map as it looks in game, composed from its 32x32 pixel tiles and area averaged down to at most nominalSize across.
+// Output rows are rendered in bands, a band's source pixels at a time straight from the tiles and into the output,
+// so however big the map only the output image is ever held whole. The bands are spread over pool.
+QImage renderTiles(const MapModel& map, const QVector<QRgb>& palette, int nominalSize, rwe::ThreadPool& pool)
+{
+    const int tileColumns = map.width / 2;
+    const int tileRows = map.height / 2;
+    const int srcWidth = tileColumns * 32;
+    const int srcHeight = tileRows * 32;
+    LOG_DEBUG("[renderTiles] " << srcWidth << 'x' << srcHeight << ", nominalSize=" << nominalSize);
+    if (srcWidth <= 0 || srcHeight <= 0)
+    {
+        return QImage();
+    }
+
+    // never enlarged, since there's no more detail to be had. A nominalSize of 0 is full size
+    double scale = nominalSize > 0 ? std::min(1.0, double(nominalSize) / double(std::max(srcWidth, srcHeight))) : 1.0;
+    const int outWidth = std::max(1, int(scale * double(srcWidth) + 0.5));
+    const int outHeight = std::max(1, int(scale * double(srcHeight) + 0.5));
+
+    // each source column and row lands in exactly one output column and row, as in downscale()
+    const std::vector<int> outX = areaTargets(srcWidth, outWidth);
+    std::vector<std::uint32_t> columnCounts(outWidth, 0u);
+    for (int x : outX)
+    {
+        ++columnCounts[x];
+    }
+    auto firstSourceRow = [srcHeight, outHeight](int outY)
+    {
+        return int((std::int64_t(outY) * srcHeight + outHeight - 1) / outHeight);
+    };
+
+    std::array<std::uint32_t, 256> colours;
+    for (int n = 0; n < 256; ++n)
+    {
+        colours[n] = n < palette.size() ? palette[n] : 0u;
+    }
+
+    const std::uint32_t tileCount = std::uint32_t(map.tileGraphics.size() / (32u * 32u));
+    static const std::uint8_t missingTile[32 * 32] = {};
+
+    QImage im(outWidth, outHeight, QImage::Format_RGB888);
+    std::uint8_t* bits = im.bits();
+    const std::size_t bytesPerLine = std::size_t(im.bytesPerLine());
+
+    // about a tile's worth of source rows per band
+    const int bandRows = std::max(1, int(std::int64_t(outHeight) * 32 / srcHeight));
+    const std::size_t bandCount = std::size_t((outHeight + bandRows - 1) / bandRows);
+    pool.forEach(bandCount, [&](std::size_t band)
+    {
+        std::vector<std::uint32_t> sums(std::size_t(outWidth) * 3u);
+        const int outY0 = int(band) * bandRows;
+        const int outY1 = std::min(outHeight, outY0 + bandRows);
+        for (int outY = outY0; outY < outY1; ++outY)
+        {
+            std::fill(sums.begin(), sums.end(), 0u);
+            const int srcY0 = firstSourceRow(outY);
+            const int srcY1 = firstSourceRow(outY + 1);
+            for (int y = srcY0; y < srcY1; ++y)
+            {
+                const std::uint16_t* indices = &map.tileIndices[std::size_t(y / 32) * tileColumns];
+                for (int tx = 0; tx < tileColumns; ++tx)
+                {
+                    const std::uint8_t* tile = indices[tx] < tileCount ? &map.tileGraphics[std::size_t(indices[tx]) * 32u * 32u] : missingTile;
+                    const std::uint8_t* pixels = tile + (y % 32) * 32;
+                    const int* columns = &outX[tx * 32];
+                    for (int i = 0; i < 32; ++i)
+                    {
+                        std::uint32_t rgb = colours[pixels[i]];
+                        std::uint32_t* sum = &sums[std::size_t(columns[i]) * 3u];
+                        sum[0] += qRed(rgb);
+                        sum[1] += qGreen(rgb);
+                        sum[2] += qBlue(rgb);
+                    }
+                }
+            }
+
+            const std::uint32_t rows = std::uint32_t(srcY1 - srcY0);
+            std::uint8_t* line = bits + std::size_t(outY) * bytesPerLine;
+            for (int x = 0; x < outWidth; ++x)
+            {
+                const std::uint32_t count = columnCounts[x] * rows;
+                for (int c = 0; c < 3; ++c)
+                {
+                    line[x * 3 + c] = std::uint8_t((sums[std::size_t(x) * 3u + c] + count / 2u) / count);
+                }
+            }
+        }
+    });
+    return im;
+}
+
+QImage createPositionsMapImage(const MapModel& map, QVector<uint> palette, int positionCount, int nominalSize)
 {
     LOG_DEBUG("[createPositionsMapImage]");
-    QImage im;
-    im = readMiniMap(tnt);
-    double scale = double(im.width()) / double(tnt.getHeader().width);
+    QImage im = map.miniMap;
+    double scale = double(im.width()) / double(map.width);
     im.setColorTable(palette);
     im = im.convertToFormat(QImage::Format_RGB888);
     scale *= resize(im, nominalSize);
 
     QPainter painter(&im);
 
-    const std::vector< std::pair<int, int> > startPositions = getStartingPositions(ota, positionCount);
+    const std::vector< std::pair<int, int> >& startPositions = map.startPositions;
 
     int positionNumber = startPositions.size();
     for (auto it=startPositions.rbegin(); it!=startPositions.rend(); ++it, --positionNumber)
@@ -868,23 +1317,23 @@ QImage createPositionsMapImage(const rwe::TntArchive& tnt, const ta::TdfFile& ot
     return im;
 }
 
-QImage createTransparentMapImage(const rwe::TntArchive& tnt, int nominalSize)
+QImage createTransparentMapImage(const MapModel& map, int nominalSize)
 {
-    QImage im(tnt.getHeader().width, tnt.getHeader().height, QImage::Format_ARGB32);
+    QImage im(map.width, map.height, QImage::Format_ARGB32);
     im.fill(Qt::transparent);
-    resizeToMapDimensions(im, tnt, nominalSize);
+    resizeToMapDimensions(im, map, nominalSize);
     return im;
 }
 
-QImage createPositionsOverlayImage(const rwe::TntArchive& tnt, const ta::TdfFile& ota, int positionCount, int nominalSize)
+QImage createPositionsOverlayImage(const MapModel& map, int positionCount, int nominalSize)
 {
     LOG_DEBUG("[createPositionsOverlayImage]");
-    QImage im = createTransparentMapImage(tnt, nominalSize);
-    double scale = double(im.width()) / double(tnt.getHeader().width);
+    QImage im = createTransparentMapImage(map, nominalSize);
+    double scale = double(im.width()) / double(map.width);
 
     QPainter painter(&im);
 
-    const std::vector< std::pair<int, int> > startPositions = getStartingPositions(ota, positionCount);
+    const std::vector< std::pair<int, int> >& startPositions = map.startPositions;
 
     int positionNumber = startPositions.size();
     for (auto it=startPositions.rbegin(); it!=startPositions.rend(); ++it, --positionNumber)
@@ -901,16 +1350,13 @@ QImage createPositionsOverlayImage(const rwe::TntArchive& tnt, const ta::TdfFile
 // centre normalised to [0,1] over the map's dimensions (same frame the overlay
 // image uses: position x/16,y/16 over tnt header width/height). The client draws
 // its own position markers from this instead of magnifying a rendered overlay.
-QString createStartPositionsData(const std::string& tntData, const std::string& otaData, int positionCount)
+QString createStartPositionsData(const MapModel& map)
 {
     LOG_DEBUG("[createStartPositionsData]");
-    std::istringstream ss(tntData);
-    rwe::TntArchive tnt(&ss);
-    ta::TdfFile ota(otaData, 10);
 
-    const int mapWidth = tnt.getHeader().width;
-    const int mapHeight = tnt.getHeader().height;
-    const std::vector< std::pair<int, int> > startPositions = getStartingPositions(ota, positionCount);
+    const int mapWidth = map.width;
+    const int mapHeight = map.height;
+    const std::vector< std::pair<int, int> >& startPositions = map.startPositions;
 
     QString out;
     int n = 0;
@@ -1047,16 +1493,16 @@ std::vector<std::tuple<int, int, int> > normaliseFeatures(const std::vector<std:
     return normalisedFeatures;
 }
 
-QImage createResourceOverlayImage(const rwe::TntArchive& tnt, const ta::TdfFile& ota, const ta::TdfFile& featureLibrary, int maxPositions, Qt::GlobalColor background, Qt::GlobalColor foreground,
+QImage createResourceOverlayImage(const MapModel& map, const ta::FlatTdfFile& featureLibrary, int maxPositions, Qt::GlobalColor background, Qt::GlobalColor foreground,
     const std::string &matchKey, const std::string &matchValue, const std::string &valueKey, int resourceScaleFactor, int nominalSize)
 {
     LOG_DEBUG("[createResourceOverlayImage] matchKey=" << matchKey << ", matchValue=" << matchValue << ", valueKey=" << valueKey);
 
     Qt::GlobalColor summaryColour = foreground; // Qt::GlobalColor(int(Qt::transparent) - int(foreground));
-    QImage im = createTransparentMapImage(tnt, nominalSize);
-    double scale = double(im.width()) / double(tnt.getHeader().width);
+    QImage im = createTransparentMapImage(map, nominalSize);
+    double scale = double(im.width()) / double(map.width);
 
-    std::vector<std::pair<int, int> > startPositions = getStartingPositions(ota, maxPositions);
+    std::vector<std::pair<int, int> > startPositions = map.startPositions;
     if (startPositions.size() > unsigned(maxPositions))
     {
         startPositions.resize(maxPositions);
@@ -1067,22 +1513,11 @@ QImage createResourceOverlayImage(const rwe::TntArchive& tnt, const ta::TdfFile&
         voronoiLines(im, scaledStartPositions.begin(), scaledStartPositions.end(), summaryColour);
     }
 
-    std::vector< std::tuple<int, int, std::string> > mapFeatures;
-    appendTntFileFeatures(tnt, mapFeatures);
-    for (auto& tup : mapFeatures)
-    {
-        LOG_DEBUG("Tnt features:" << std::get<0>(tup) << ',' << std::get<1>(tup) << ',' << std::get<2>(tup));
-    }
-    appendOtaFileFeatures(ota, maxPositions, mapFeatures);
-    for (auto& tup : mapFeatures)
-    {
-        LOG_DEBUG("Tnt+Ota features:" << std::get<0>(tup) << ',' << std::get<1>(tup) << ',' << std::get<2>(tup));
-    }
-
-    auto matchingFeatures = lookupFeatureValues(mapFeatures, featureLibrary, matchKey, matchValue, valueKey);
+    auto matchingFeatures = lookupFeatureValues(map.features, featureLibrary, matchKey, matchValue, valueKey);
     auto normalisedMatchingFeatures = normaliseFeatures(matchingFeatures);
-    auto areaValues = voronoiAccumulateFeatures(matchingFeatures, startPositions);
-    //auto areaValues = weightedVoronoiAccumulateFeatures(matchingFeatures, startPositions);
+    // the features are in tile attribute units, as are the start positions
+    auto areaValues = voronoiAccumulateFeatures(matchingFeatures, startPositions, *map.owners);
+    //auto areaValues = weightedVoronoiAccumulateFeatures(matchingFeatures, *map.owners);
 
     QPainter painter(&im);
     for (const auto& feature : normalisedMatchingFeatures)
@@ -1108,83 +1543,87 @@ QImage createResourceOverlayImage(const rwe::TntArchive& tnt, const ta::TdfFile&
     return im;
 }
 
-QImage createResourceMapImage(const rwe::TntArchive& tnt, const ta::TdfFile& ota, const ta::TdfFile& featureLibrary, int maxPositions, Qt::GlobalColor background, Qt::GlobalColor foreground,
+QImage createResourceMapImage(const MapModel& map, const ta::FlatTdfFile& featureLibrary, int maxPositions, Qt::GlobalColor background, Qt::GlobalColor foreground,
     const std::string &matchKey, const std::string &matchValue, const std::string &valueKey, int resourceScaleFactor, int nominalSize)
 {
     LOG_DEBUG("[createResourceMapImage] matchKey=" << matchKey << ", matchValue=" << matchValue << ", valueKey=" << valueKey);
 
-    QImage im = createHeightMapImage(tnt);
+    QImage im = map.heightMap;
     resize(im, nominalSize);
 
     QPainter painter(&im);
-    painter.drawImage(0, 0, createResourceOverlayImage(tnt, ota, featureLibrary, maxPositions, background, foreground,
+    painter.drawImage(0, 0, createResourceOverlayImage(map, featureLibrary, maxPositions, background, foreground,
         matchKey, matchValue, valueKey, resourceScaleFactor, nominalSize));
 
     return im;
 }
 
-QImage createMapImage(const rwe::TntArchive& tnt, const ta::TdfFile& ota, const ta::TdfFile& allFeatures, QVector<uint> palette, QString type, int maxPositions, int nominalSize)
+QImage createMapImage(const MapModel& map, const ta::FlatTdfFile& allFeatures, QVector<uint> palette, QString type, int maxPositions, int nominalSize, rwe::ThreadPool& pool)
 {
     LOG_DEBUG("[createMapImage] type=" << type.toStdString() << ", maxPositions=" << maxPositions << ", nominalSize=" << nominalSize);
     QImage im;
     if (type == "mini")
     {
-        QImage im = readMiniMap(tnt);
+        QImage im = map.miniMap;
         im.setColorTable(palette);
-        resizeToMapDimensions(im, tnt, nominalSize);
+        resizeToMapDimensions(im, map, nominalSize);
         return im;
     }
     else if (type == "heightmap")
     {
-        QImage im = createHeightMapImage(tnt);
+        QImage im = map.heightMap;
         resize(im, nominalSize);
         return im;
     }
     else if (type == "heightmap-water")
     {
-        QImage im = createHeightMapWithWaterImage(tnt);
+        QImage im = renderHeightMap(map.width, map.height, map.tileAttributes, heightColourTable(map.seaLevel, true));
         resize(im, nominalSize);
         return im;
     }
+    else if (type == "tiles")
+    {
+        return renderTiles(map, palette, nominalSize, pool);
+    }
     else if (type == "positions")
     {
-        return createPositionsMapImage(tnt, ota, palette, maxPositions, nominalSize);
+        return createPositionsMapImage(map, palette, maxPositions, nominalSize);
     }
     else if (type == "positions-overlay")
     {
-        return createPositionsOverlayImage(tnt, ota, maxPositions, nominalSize);
+        return createPositionsOverlayImage(map, maxPositions, nominalSize);
     }
     else if (type == "mexes")
     {
-        return createResourceMapImage(tnt, ota, allFeatures, maxPositions, Qt::darkRed, Qt::yellow, "indestructible", "1", "metal", 111, nominalSize);
+        return createResourceMapImage(map, allFeatures, maxPositions, Qt::darkRed, Qt::yellow, "indestructible", "1", "metal", 111, nominalSize);
     }
     else if (type == "mexes-overlay")
     {
-        return createResourceOverlayImage(tnt, ota, allFeatures, maxPositions, Qt::darkRed, Qt::yellow, "indestructible", "1", "metal", 111, nominalSize);
+        return createResourceOverlayImage(map, allFeatures, maxPositions, Qt::darkRed, Qt::yellow, "indestructible", "1", "metal", 111, nominalSize);
     }
     else if (type == "geos")
     {
-        return createResourceMapImage(tnt, ota, allFeatures, maxPositions, Qt::darkBlue, Qt::cyan, "indestructible", "1", "geothermal", 1, nominalSize);
+        return createResourceMapImage(map, allFeatures, maxPositions, Qt::darkBlue, Qt::cyan, "indestructible", "1", "geothermal", 1, nominalSize);
     }
     else if (type == "geos-overlay")
     {
-        return createResourceOverlayImage(tnt, ota, allFeatures, maxPositions, Qt::darkBlue, Qt::cyan, "indestructible", "1", "geothermal", 1, nominalSize);
+        return createResourceOverlayImage(map, allFeatures, maxPositions, Qt::darkBlue, Qt::cyan, "indestructible", "1", "geothermal", 1, nominalSize);
     }
     else if (type == "rocks")
     {
-        return createResourceMapImage(tnt, ota, allFeatures, maxPositions, Qt::darkRed, Qt::red, "reclaimable", "1", "metal", 1, nominalSize);
+        return createResourceMapImage(map, allFeatures, maxPositions, Qt::darkRed, Qt::red, "reclaimable", "1", "metal", 1, nominalSize);
     }
     else if (type == "rocks-overlay")
     {
-        return createResourceOverlayImage(tnt, ota, allFeatures, maxPositions, Qt::darkRed, Qt::red, "reclaimable", "1", "metal", 1, nominalSize);
+        return createResourceOverlayImage(map, allFeatures, maxPositions, Qt::darkRed, Qt::red, "reclaimable", "1", "metal", 1, nominalSize);
     }
     else if (type == "trees")
     {
-        return createResourceMapImage(tnt, ota, allFeatures, maxPositions, Qt::darkGreen, Qt::green, "reclaimable", "1", "energy", 1, nominalSize);
+        return createResourceMapImage(map, allFeatures, maxPositions, Qt::darkGreen, Qt::green, "reclaimable", "1", "energy", 1, nominalSize);
     }
     else if (type == "trees-overlay")
     {
-        return createResourceOverlayImage(tnt, ota, allFeatures, maxPositions, Qt::darkGreen, Qt::green, "reclaimable", "1", "energy", 1, nominalSize);
+        return createResourceOverlayImage(map, allFeatures, maxPositions, Qt::darkGreen, Qt::green, "reclaimable", "1", "energy", 1, nominalSize);
     }
     else
     {
@@ -1203,25 +1642,94 @@ bool isInterestingFeature(const ta::TdfFile& tdf)
         tdf.getValue("reclaimable", "") == "1";
 }
 
-std::map<QString,QImage> createMapImages(const std::string& tntData, const std::string& otaData, const ta::TdfFile& allFeatures, QVector<uint> palette, QStringList types, int maxPositions, int nominalSize)
+// the size a preview type is drawn at before any resizing, i.e. with a nominalSize of 0, which is what a "full" pyramid level means
+int nativePreviewSize(const MapModel& map, const QString& type)
 {
-    LOG_DEBUG("[createMapImages]");
-    std::istringstream ss(tntData);
-    rwe::TntArchive tnt(&ss);
-    ta::TdfFile ota(otaData, 10);
-
-    std::map<QString, QImage> images;
-
-    for (QString type : types)
+    if (type == "mini" || type == "positions")
     {
-        if (type == "mini" || type == "heightmap" || type == "heightmap-water")
+        return std::max(map.miniMap.width(), map.miniMap.height());
+    }
+    else if (type == "tiles")
+    {
+        return 32 * std::max(map.width / 2, map.height / 2);
+    }
+    return std::max(map.width, map.height);
+}
+
+QString pyramidLevelName(int size)
+{
+    return size > 0 ? QString::number(size) : QString("full");
+}
+
+// Each type is rendered from the shared model, concurrently when there are workers to spare.
+// Given a pyramid (sizes, 0 for full size), images are keyed "<type>/<level>" rather than rendered at nominalSize.
+// Each type is rendered once, at full size if that's a level and otherwise at its largest level, and each smaller level
+// is downscaled from the one above. Levels larger than full size can't come from the full size render, so are each rendered as they are.
+std::map<QString,QImage> createMapImages(const MapModel& map, const ta::FlatTdfFile& allFeatures, QVector<uint> palette, QStringList types, int maxPositions, int nominalSize,
+    const std::vector<int>& pyramid, rwe::ThreadPool& pool)
+{
+    LOG_DEBUG("[createMapImages]");
+
+    std::vector<QString> keys;
+    std::vector<QString> keyTypes;
+    std::vector<int> positionCounts;
+    for (QString type : types)
+    {
+        keyTypes.push_back(type);
+        if (type == "mini" || type == "heightmap" || type == "heightmap-water" || type == "tiles")
         {
-            images[type] = createMapImage(tnt, ota, allFeatures, palette, type, 10, nominalSize);
+            keys.push_back(type);
+            positionCounts.push_back(10);
         }
         else
         {
-            QString key = type + '_' + QString::number(maxPositions);
-            images[key] = createMapImage(tnt, ota, allFeatures, palette, type, maxPositions, nominalSize);
+            keys.push_back(type + '_' + QString::number(maxPositions));
+            positionCounts.push_back(maxPositions);
+        }
+    }
+
+    std::vector<std::vector<std::pair<QString, QImage> > > rendered(keys.size());
+    pool.forEach(keys.size(), [&](std::size_t n)
+    {
+        if (pyramid.empty())
+        {
+            rendered[n].emplace_back(keys[n], createMapImage(map, allFeatures, palette, keyTypes[n], positionCounts[n], nominalSize, pool));
+            return;
+        }
+
+        // largest first, in this type's own pixels, full size ahead of an equal numbered level
+        const int nativeSize = nativePreviewSize(map, keyTypes[n]);
+        const bool hasFull = std::find(pyramid.begin(), pyramid.end(), 0) != pyramid.end();
+        std::vector<std::pair<int, int> > levels;
+        for (int size : pyramid)
+        {
+            levels.emplace_back(size > 0 ? size : nativeSize, size > 0 ? size : std::numeric_limits<int>::max());
+        }
+        std::sort(levels.begin(), levels.end(), std::greater<std::pair<int, int> >());
+
+        QImage im;
+        for (const std::pair<int, int>& level : levels)
+        {
+            const int size = level.second == std::numeric_limits<int>::max() ? 0 : level.second;
+            if (hasFull && size > nativeSize)
+            {
+                rendered[n].emplace_back(keys[n] + '/' + pyramidLevelName(size), createMapImage(map, allFeatures, palette, keyTypes[n], positionCounts[n], size, pool));
+                continue;
+            }
+
+            im = im.isNull()
+                ? createMapImage(map, allFeatures, palette, keyTypes[n], positionCounts[n], hasFull ? 0 : size, pool)
+                : downscale(im, level.first);
+            rendered[n].emplace_back(keys[n] + '/' + pyramidLevelName(size), im);
+        }
+    });
+
+    std::map<QString, QImage> images;
+    for (const auto& typeImages : rendered)
+    {
+        for (const std::pair<QString, QImage>& image : typeImages)
+        {
+            images[image.first] = image.second;
         }
     }
     return images;
@@ -1270,6 +1778,362 @@ void saveStartPositionsData(QFileInfo mapFileInfo, QString directory, int maxPos
     }
 }
 
+// The interesting features of each feature file, kept between runs (in --featurescachedir) by archive entry identity,
+// so that changing one feature file only costs parsing that file again
+static const std::uint32_t FeatureFileCacheMagicNumber = 0x46465441; // "ATFF"
+static const std::uint32_t FeatureFileCacheVersion = 1; // bump whenever isInterestingFeature() changes
+static const unsigned int MaxFeatureDepth = 16;
+typedef std::map<rwe::HpiContentCache::Key, ta::TdfFile> FeatureFileCache;
+
+void writeFeatures(std::ostream& os, const ta::TdfFile& tdf)
+{
+    rwe::writeCacheRaw<std::uint32_t>(os, tdf.values.size());
+    for (const auto& p : tdf.values)
+    {
+        rwe::writeCacheString(os, p.first);
+        rwe::writeCacheString(os, p.second);
+    }
+    rwe::writeCacheRaw<std::uint32_t>(os, tdf.children.size());
+    for (const auto& p : tdf.children)
+    {
+        rwe::writeCacheString(os, p.first);
+        writeFeatures(os, p.second);
+    }
+}
+
+// as TdfFile::deserialise, but bounded and throwing on anything malformed
+void readFeatures(std::istream& is, ta::TdfFile& tdf, unsigned int depth)
+{
+    if (depth > MaxFeatureDepth)
+    {
+        throw rwe::HpiException("Corrupt cache file");
+    }
+    std::uint32_t nValues = rwe::readCacheRaw<std::uint32_t>(is);
+    for (std::uint32_t n = 0u; n < nValues; ++n)
+    {
+        std::string key = rwe::readCacheString(is);
+        tdf.values[key] = rwe::readCacheString(is);
+    }
+    std::uint32_t nChildren = rwe::readCacheRaw<std::uint32_t>(is);
+    for (std::uint32_t n = 0u; n < nChildren; ++n)
+    {
+        std::string name = rwe::readCacheString(is);
+        readFeatures(is, tdf.children[name], depth + 1u);
+    }
+}
+
+FeatureFileCache loadFeatureFileCache(const QString& fileName)
+{
+    FeatureFileCache cache;
+    std::ifstream ifs(fileName.toStdString(), std::ios::binary);
+    if (!ifs)
+    {
+        return cache;
+    }
+
+    try
+    {
+        if (rwe::readCacheRaw<std::uint32_t>(ifs) != FeatureFileCacheMagicNumber || rwe::readCacheRaw<std::uint32_t>(ifs) != FeatureFileCacheVersion)
+        {
+            LOG_DEBUG("  ignoring incompatible feature file cache");
+            return cache;
+        }
+
+        std::uint32_t count = rwe::readCacheRaw<std::uint32_t>(ifs);
+        for (std::uint32_t n = 0u; n < count; ++n)
+        {
+            rwe::HpiContentCache::Key key = rwe::readContentCacheKey(ifs);
+            readFeatures(ifs, cache[key], 0u);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG_DEBUG("  ignoring unreadable feature file cache:" << e.what());
+        cache.clear();
+    }
+    return cache;
+}
+
+// Drops the files of archives that have gone, or changed since, so those entries can never be hit again.
+// Entries for archives this run didn't look at are kept, since other installs and runs share the cache. Returns how many were dropped
+std::size_t dropStaleFeatureFiles(FeatureFileCache& cache)
+{
+    std::map<std::string, bool> archiveCurrent;
+    std::size_t dropped = 0u;
+    for (auto it = cache.begin(); it != cache.end();)
+    {
+        const rwe::HpiContentCache::Key& key = it->first;
+        auto itCurrent = archiveCurrent.find(key.archivePath);
+        if (itCurrent == archiveCurrent.end())
+        {
+            bool current = false;
+            try
+            {
+                std::uint64_t size;
+                std::int64_t modificationTime;
+                rwe::statFile(key.archivePath, size, modificationTime);
+                current = size == key.archiveSize && modificationTime == key.archiveModificationTime;
+            }
+            catch (const std::exception&)
+            {
+            }
+            itCurrent = archiveCurrent.emplace(key.archivePath, current).first;
+        }
+
+        if (itCurrent->second)
+        {
+            ++it;
+        }
+        else
+        {
+            it = cache.erase(it);
+            ++dropped;
+        }
+    }
+    return dropped;
+}
+
+// Other maptool instances may have saved since the cache was loaded, so what they added is folded into cache, under a lock
+void saveFeatureFileCache(const QString& fileName, FeatureFileCache& cache)
+{
+    rwe::CacheFileLock lock(fileName.toStdString() + ".lock");
+    if (!lock)
+    {
+        LOG_DEBUG("  feature file cache is locked by another process, not saving");
+        return;
+    }
+
+    FeatureFileCache saved = loadFeatureFileCache(fileName);
+    dropStaleFeatureFiles(saved);
+    cache.insert(saved.begin(), saved.end());
+
+    std::ostringstream ss;
+    rwe::writeCacheRaw(ss, FeatureFileCacheMagicNumber);
+    rwe::writeCacheRaw(ss, FeatureFileCacheVersion);
+    rwe::writeCacheRaw<std::uint32_t>(ss, cache.size());
+    for (const auto& p : cache)
+    {
+        rwe::writeContentCacheKey(ss, p.first);
+        writeFeatures(ss, p.second);
+    }
+
+    std::string bytes = ss.str();
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(bytes.data(), bytes.size()) != qint64(bytes.size()) || !file.commit())
+    {
+        LOG_DEBUG("  unable to save feature file cache");
+    }
+}
+
+// the features in one feature file that maps can use, i.e. that have resources
+ta::TdfFile loadInterestingFeatures(const HpiEntry& entry)
+{
+    std::string tdfData = hpiLoad(entry);
+
+    LOG_DEBUG("  parsing features");
+    ta::TdfFile features(tdfData, 1);
+
+    LOG_DEBUG("  filtering for interesting features");
+    ta::TdfFile interesting;
+    for (const auto& f : features.children)
+    {
+        if (isInterestingFeature(f.second))
+        {
+            std::ostringstream ss;
+            f.second.dumpjson(ss);
+            LOG_DEBUG("file:" << entry.archivePath << '/' << entry.filePath << ", feature:" << f.first << ", " << ss.str());
+            interesting.children[f.first] = f.second;
+        }
+    }
+    return interesting;
+}
+
+// What every MapJob of a run is asked to produce, and the shared inputs it needs
+struct MapJobSettings
+{
+    bool doHash;
+    bool doSql;
+    bool doThumb;
+    QString thumbDir;
+    QStringList thumbTypes;
+    int maxPositions;
+    int thumbSize;
+    std::vector<int> thumbPyramid;  // sizes, 0 for full size. Empty for just thumbSize
+    QVector<QRgb> palette;
+    const ta::FlatTdfFile* allFeatures;
+    const NSWFL::Hashing::CRC32* crc32;
+    rwe::ThreadPool* pool;
+};
+
+// Hash, listing and previews of one map.
+// Its .ota is extracted and parsed once, and its .tnt extracted at most once, to feed all of them.
+class MapJob
+{
+    const MapJobSettings& settings;
+    QFileInfo otaFileInfo;
+    const HpiEntry& otaEntry;
+    const HpiEntry* tntEntry;   // null if the map has no .tnt
+    std::string tntData;        // only if the .tnt had to be extracted whole
+
+public:
+    MapJob(const MapJobSettings& settings, const QFileInfo& otaFileInfo, const HpiEntry& otaEntry, const HpiEntry* tntEntry) :
+        settings(settings),
+        otaFileInfo(otaFileInfo),
+        otaEntry(otaEntry),
+        tntEntry(tntEntry)
+    { }
+
+    // returns the map's listing, empty if it isn't a skirmish map
+    std::string run()
+    {
+        LOG_DEBUG("--- processing map file " << otaEntry.filePath);
+        std::string otaData = hpiLoad(otaEntry);
+        const bool isSkirmish = isSkirmishMap(otaData);
+        if (!isSkirmish && !settings.doThumb)
+        {
+            LOG_DEBUG("  not a skirmish map. ignoring");
+            return std::string();
+        }
+
+        // the previews need the schemas, a listing only the header. Either way, only the sections used get parsed
+        LOG_DEBUG("  indexing .ota file");
+        ta::LazyTdfFile ota(otaData, settings.doThumb ? 10 : 1);
+
+        std::uint32_t crc = 0u;
+        if (isSkirmish && settings.doHash)
+        {
+            if (tntEntry)
+            {
+                crc = hashTnt();
+            }
+            LOG_DEBUG("  calculating .ota part of CRC");
+            settings.crc32->PartialCRC(&crc, (const std::uint8_t*)otaData.data(), otaData.size());
+            crc ^= -1;
+        }
+
+        if (settings.doThumb && tntEntry)
+        {
+            // a broken preview shouldn't cost the map its listing
+            try
+            {
+                writePreviews(ota);
+            }
+            catch (const std::exception & e)
+            {
+                LOG_DEBUG("  exception generating previews for map file " << tntEntry->archivePath << '/' << tntEntry->filePath << ":" << e.what());
+            }
+            catch (...)
+            {
+                LOG_DEBUG("  unknown exception generating previews for map file " << tntEntry->archivePath << '/' << tntEntry->filePath);
+            }
+        }
+
+        if (!isSkirmish)
+        {
+            LOG_DEBUG("  not a skirmish map. ignoring");
+            return std::string();
+        }
+
+        std::ostringstream os;
+        if (settings.doSql)
+        {
+            LOG_DEBUG("  listing file (sql)");
+            sqlMap(os, otaFileInfo.baseName().toStdString(), otaEntry.archivePath, ota, crc);
+        }
+        else
+        {
+            LOG_DEBUG("  listing file (delimited text)");
+            lsMap(os, otaFileInfo.baseName().toStdString(), otaEntry.archivePath, ota, settings.doHash ? crc : 0u);
+        }
+        return os.str();
+    }
+
+private:
+    // the running (unfinalised) CRC after the .tnt
+    std::uint32_t hashTnt()
+    {
+        std::uint32_t tntCrc;
+        if (contentCache && contentCache->findCrc(contentCacheKey(*tntEntry), tntCrc))
+        {
+            // the running CRC after the .tnt is just its CRC32, unfinalised
+            LOG_DEBUG("  using cached .tnt part of CRC");
+            return tntCrc ^ 0xffffffffu;
+        }
+
+        LOG_DEBUG("  calculating .tnt part of CRC");
+        std::uint32_t crc(-1);
+        if (settings.doThumb)
+        {
+            // the previews will read it too, so extract it once for both
+            tntData = hpiLoad(*tntEntry, *settings.pool);
+            settings.crc32->PartialCRC(&crc, (const std::uint8_t*)tntData.data(), tntData.size());
+        }
+        else
+        {
+            // hash each chunk as it's decompressed, however big the map
+            hpiRepository.visit(tntEntry->archivePath, *tntEntry->file, [&](const char* data, std::size_t size)
+            {
+                settings.crc32->PartialCRC(&crc, (const std::uint8_t*)data, size);
+            });
+        }
+        if (contentCache)
+        {
+            contentCache->insertCrc(contentCacheKey(*tntEntry), crc ^ 0xffffffffu);
+        }
+        return crc;
+    }
+
+    void writePreviews(const ta::LazyTdfFile& ota)
+    {
+        // previews only visit parts of the .tnt, so unless it's already loaded for hashing
+        // read it lazily, leaving e.g. the tile graphics compressed
+        std::unique_ptr<std::streambuf> tntBuffer;
+        if (!tntData.empty())
+        {
+            tntBuffer.reset(new std::stringbuf(tntData, std::ios::in));
+        }
+        else
+        {
+            tntBuffer.reset(new rwe::HpiStreamBuf(hpiRepository.get(tntEntry->archivePath), *tntEntry->file));
+        }
+        std::istream tntStream(tntBuffer.get());
+        tntStream.exceptions(std::ios::badbit);   // rethrow extraction errors rather than swallow them
+        rwe::TntArchive tnt(&tntStream);
+
+        QFileInfo tntFileInfo(tntEntry->filePath.c_str());
+
+        // decode what the previews need just the once, rather than once per preview type
+        LOG_DEBUG("  decoding map");
+        MapModel map = decodeMap(tnt, ota, settings.thumbTypes, settings.maxPositions);
+
+        // Image thumbnails: everything except the coordinate side-car.
+        QStringList imageTypes;
+        for (const QString& t : settings.thumbTypes)
+        {
+            if (t != "positions-coords")
+            {
+                imageTypes.append(t);
+            }
+        }
+        if (!imageTypes.isEmpty())
+        {
+            LOG_DEBUG("  generating map images");
+            auto images = createMapImages(map, *settings.allFeatures, settings.palette, imageTypes, settings.maxPositions, settings.thumbSize, settings.thumbPyramid, *settings.pool);
+            LOG_DEBUG("  saving map images");
+            saveMapImages(tntFileInfo, settings.thumbDir, images);
+        }
+
+        // Start-position coordinate side-car (text), consumed by the client
+        // to draw its own position markers rather than a rendered overlay.
+        if (settings.thumbTypes.contains("positions-coords"))
+        {
+            LOG_DEBUG("  generating start-position coordinates");
+            QString data = createStartPositionsData(map);
+            saveStartPositionsData(tntFileInfo, settings.thumbDir, settings.maxPositions, data);
+        }
+    }
+};
+
 int main(int argc, char *argv[])
 {
     for (int i = 0; i < argc; ++i)
@@ -1281,19 +2145,7 @@ int main(int argc, char *argv[])
         }
     }
 
-#ifdef _WIN32
-    LOG_DEBUG("-- app start. default maxstdio=" + std::to_string(_getmaxstdio()));
-    int maxstdio = 65535;
-    while (_setmaxstdio(maxstdio) != maxstdio)
-    {
-        maxstdio = 9 * maxstdio / 10;
-    }
-    {
-        LOG_DEBUG("set maxstdio=" + std::to_string(_getmaxstdio()));
-    }
-#else
     LOG_DEBUG("-- app start");
-#endif
 
     QApplication app(argc, argv);
     QApplication::setApplicationName("MapTool");
@@ -1309,11 +2161,79 @@ int main(int argc, char *argv[])
     parser.addOption(QCommandLineOption("thumbtypes", "comma separated list of preview types.", "thumbtypes", "mini,positions,mexes,geos,rocks,trees"));
     parser.addOption(QCommandLineOption("maxpositions", "maximum number of player positions to analyse for.", "maxpositions", "10"));
     parser.addOption(QCommandLineOption("thumbsize", "nominal size of thumbnail image.", "thumbsize", "375"));
+    parser.addOption(QCommandLineOption("thumbpyramid", "comma separated nominal sizes, or 'full', to make each thumbnail at in one go, each area averaged from the next larger, e.g. 64,128,256,512,full. saved in a subdirectory per size, instead of thumbsize.", "thumbpyramid"));
     parser.addOption(QCommandLineOption("sql", "output map info in SQL format suitable for insertion into TAF DB.  argument specifies map version to use."));
     parser.addOption(QCommandLineOption("featurescachedir", "load TA features and cache them for future use when generating thumbnails", "featurescachedir"));
+    parser.addOption(QCommandLineOption("jobs", "number of archives/maps/file chunks to process concurrently. 0 for one per CPU core.", "jobs", "1"));
+    parser.addOption(QCommandLineOption("indexcachedir", "cache hpi archive directories for future use, so unchanged archives aren't decrypted again", "indexcachedir"));
+    parser.addOption(QCommandLineOption("contentcachedir", "cache extracted files and .tnt CRCs for future use", "contentcachedir"));
+    parser.addOption(QCommandLineOption("contentcachesize", "maximum size of the content cache in MiB.", "contentcachesize", "256"));
+    parser.addOption(QCommandLineOption("maxopenarchives", "maximum number of archives to keep memory mapped at once.", "maxopenarchives", "64"));
+    parser.addOption(QCommandLineOption("maxmappedmb", "maximum MiB of archives to keep memory mapped at once. Larger archives, and any that can't be mapped, are read as streams.", "maxmappedmb",
+        QString::number(rwe::HpiArchiveRepository::DefaultMaxMappedBytes >> 20)));
     parser.addOption(QCommandLineOption("verbose", "spit out some debugging information"));
     parser.process(app);
 
+    // checked up front, so that a mistyped level fails the run rather than quietly going missing
+    std::vector<int> thumbPyramid;
+    if (parser.isSet("thumbpyramid"))
+    {
+        for (const QString& level : parser.value("thumbpyramid").split(','))
+        {
+            bool ok = false;
+            int size = level.trimmed().toInt(&ok);
+            if (level.trimmed() == "full")
+            {
+                thumbPyramid.push_back(0);
+            }
+            else if (ok && size > 0)
+            {
+                thumbPyramid.push_back(size);
+            }
+            else
+            {
+                std::cerr << "invalid --thumbpyramid level '" << level.toStdString() << "': expected a positive size or 'full'" << std::endl;
+                return 1;
+            }
+        }
+        std::sort(thumbPyramid.begin(), thumbPyramid.end());
+        thumbPyramid.erase(std::unique(thumbPyramid.begin(), thumbPyramid.end()), thumbPyramid.end());
+    }
+
+    hpiRepository.setMaxOpenArchives(std::max(1, parser.value("maxopenarchives").toInt()));
+    hpiRepository.setMaxMappedBytes(std::uint64_t(std::max(0ll, parser.value("maxmappedmb").toLongLong())) << 20);
+
+    rwe::HpiIndexCache hpiIndexCache;
+    QString hpiIndexCacheFile;
+    if (parser.isSet("indexcachedir"))
+    {
+        hpiIndexCacheFile = parser.value("indexcachedir") + "/" + "hpiindex";
+        std::ifstream ifs(hpiIndexCacheFile.toStdString(), std::ios::binary);
+        if (ifs)
+        {
+            LOG_DEBUG("--- loading cached hpi index. filename=" << hpiIndexCacheFile.toStdString());
+            try
+            {
+                hpiIndexCache.deserialise(ifs);
+            }
+            catch (const std::exception& e)
+            {
+                LOG_DEBUG("  discarding hpi index cache:" << e.what());
+            }
+        }
+        hpiRepository.setIndexCache(&hpiIndexCache);
+    }
+
+    if (parser.isSet("contentcachedir"))
+    {
+        QDir().mkpath(parser.value("contentcachedir"));
+        std::uint64_t maxBytes = std::uint64_t(std::max(1, parser.value("contentcachesize").toInt())) << 20;
+        contentCache.reset(new rwe::HpiContentCache(parser.value("contentcachedir").toStdString(), maxBytes));
+    }
+
+    rwe::ThreadPool pool(rwe::ThreadPool::threadCountForJobs(parser.value("jobs").toInt()));
+    LOG_DEBUG("--- worker threads:" << pool.size());
+
     NSWFL::Hashing::CRC32 crc32;
     crc32.Initialize();
 
@@ -1333,6 +2253,13 @@ int main(int argc, char *argv[])
             parser.value("thumbtypes").contains("trees"));
 
     LOG_DEBUG("--- inspecting hpi archives ...");
+    if (pool.size() > 0)
+    {
+        for (QString hpiSpec : parser.value("hpispecs").split(';'))
+        {
+            HpiPreload(parser.value("gamepath").toStdString(), hpiSpec.toStdString(), pool);
+        }
+    }
     for (QString hpiSpec : parser.value("hpispecs").split(';'))
     {
         HpiDirectory(mapFiles, parser.value("gamepath").toStdString(), hpiSpec.toStdString(), "maps",
@@ -1358,229 +2285,254 @@ int main(int argc, char *argv[])
         }
     }
 
-    ta::TdfFile allFeatures;
+    // the file is shared by every run and install using --indexcachedir, so only archives that have gone or changed are dropped
+    if (!hpiIndexCacheFile.isEmpty())
+    {
+        hpiIndexCache.dropStale();
+    }
+    if (!hpiIndexCacheFile.isEmpty() && hpiIndexCache.isDirty())
+    {
+        LOG_DEBUG("--- saving hpi index to cache. filename=" << hpiIndexCacheFile.toStdString());
+
+        // other maptool instances may have saved since we loaded, so fold theirs in under a lock,
+        // and write with QSaveFile, because they may also be reading the cache while we write it
+        rwe::CacheFileLock lock(hpiIndexCacheFile.toStdString() + ".lock");
+        if (lock)
+        {
+            rwe::HpiIndexCache saved;
+            std::ifstream ifs(hpiIndexCacheFile.toStdString(), std::ios::binary);
+            if (ifs)
+            {
+                try
+                {
+                    saved.deserialise(ifs);
+                }
+                catch (const std::exception& e)
+                {
+                    LOG_DEBUG("  discarding saved hpi index cache:" << e.what());
+                }
+            }
+            hpiIndexCache.merge(saved);
+            hpiIndexCache.dropStale();
+
+            std::ostringstream ss;
+            hpiIndexCache.serialise(ss);
+            std::string bytes = ss.str();
+            QSaveFile file(hpiIndexCacheFile);
+            if (!file.open(QIODevice::WriteOnly) || file.write(bytes.data(), bytes.size()) != qint64(bytes.size()) || !file.commit())
+            {
+                LOG_DEBUG("  unable to save hpi index cache");
+            }
+        }
+        else
+        {
+            LOG_DEBUG("  hpi index cache is locked by another process, not saving");
+        }
+    }
+
+    // the features cache is used in place, straight from the mapped file, so it must stay open while the features are in use
+    QFile allFeaturesCache;
+    std::unique_ptr<ta::FlatTdfFile> allFeatures;
     if (doLoadFeatures)
     {
+        // the library depends on which entries of which archives the feature files are, and on the order they override in
         LOG_DEBUG("--- calculating feature files CRC ...");
         std::uint32_t crcFeatureFiles(-1);
+        std::vector<rwe::HpiContentCache::Key> featureKeys;
         for (const auto& p : featureFiles)
         {
-            std::string filePath = p.second.filePath;
+            featureKeys.push_back(contentCacheKey(p.second));
+            const rwe::HpiContentCache::Key& key = featureKeys.back();
+            const std::string& filePath = p.first;
             crc32.PartialCRC(&crcFeatureFiles, (const unsigned char*)filePath.data(), filePath.size());
-            crc32.PartialCRC(&crcFeatureFiles, (const unsigned char*)&p.second.fileSize, sizeof(p.second.fileSize));
+            crc32.PartialCRC(&crcFeatureFiles, (const unsigned char*)key.archivePath.data(), key.archivePath.size());
+            for (std::uint64_t field : { key.archiveSize, std::uint64_t(key.archiveModificationTime), key.offset, key.size, std::uint64_t(key.compressionScheme) })
+            {
+                crc32.PartialCRC(&crcFeatureFiles, (const unsigned char*)&field, sizeof(field));
+            }
         }
 
-        QString allFeaturesCacheFile(parser.value("featurescachedir") + "/" + "tafeatures." + QString::number(crcFeatureFiles, 16));
-        if (QFile(allFeaturesCacheFile).exists())
+        QString featuresCacheDir = parser.value("featurescachedir");
+        QString allFeaturesCacheFile(featuresCacheDir + "/" + "tafeatures." + QString::number(crcFeatureFiles, 16) + ".flat");
+        if (parser.isSet("featurescachedir"))
         {
-            LOG_DEBUG("--- loading cached features. filename=" << allFeaturesCacheFile.toStdString());
-            std::ifstream ifs(allFeaturesCacheFile.toStdString(), std::ios::binary);
-            allFeatures.deserialise(ifs);
-        }
-        else
-        {
-            LOG_DEBUG("--- loading features from hpi archives ...");
-            for (const auto& p : featureFiles)
+            allFeaturesCache.setFileName(allFeaturesCacheFile);
+            if (allFeaturesCache.open(QIODevice::ReadOnly))
             {
+                LOG_DEBUG("--- loading cached features. filename=" << allFeaturesCacheFile.toStdString());
+                const uchar* data = allFeaturesCache.map(0, allFeaturesCache.size());
                 try
                 {
-                    QFileInfo fileInfo(p.second.filePath.c_str());
-                    std::string tdfData = hpiLoad(p.second);
-
-                    LOG_DEBUG("  parsing features");
-                    ta::TdfFile features(tdfData, 1);
-
-                    LOG_DEBUG("  filtering for interesting features");
-                    for (const auto& f : features.children)
+                    if (data)
                     {
-                        if (isInterestingFeature(f.second))
-                        {
-                            std::ostringstream ss;
-                            f.second.dumpjson(ss);
-                            LOG_DEBUG("file:" << p.second.archivePath << '/' << p.second.filePath << ", feature:" << f.first << ", " << ss.str());
-                            allFeatures.children[f.first] = f.second;
-                        }
+                        allFeatures.reset(new ta::FlatTdfFile((const char*)data, allFeaturesCache.size()));
                     }
                 }
                 catch (const std::exception& e)
                 {
-                    LOG_DEBUG("  exception loading/parsing file:" << e.what());
-                    continue;
+                    LOG_DEBUG("  unable to use cached features:" << e.what());
                 }
-                catch (...)
+                if (!allFeatures)
                 {
-                    LOG_DEBUG("  exception loading/parsing file");
-                    continue;
+                    allFeaturesCache.close();
                 }
             }
-            if (parser.isSet("featurescachedir"))
-            {
-                LOG_DEBUG("--- saving features to cache. filename=" << allFeaturesCacheFile.toStdString() << ", values:" << allFeatures.values.size() << ", children:" << allFeatures.children.size());
-                std::ofstream ofs(allFeaturesCacheFile.toStdString(), std::ios::binary);
-                allFeatures.serialise(ofs);
-            }
         }
-    }
 
-    std::map<std::string, std::uint32_t> crcByMap;
-    if (parser.isSet("thumb") || doHash)
-    {
-        std::map<QString, std::string> otaFileNameLookup;
-        LOG_DEBUG("--- populating otaFileNameLookup");
-        for (const auto& p : mapFiles)
+        if (!allFeatures)
         {
-            QFileInfo fileInfo(p.second.filePath.c_str());
-            if (fileInfo.suffix().toLower() == "ota")
-            {
-                otaFileNameLookup[fileInfo.baseName()] = p.first;
-            }
-        }
-
-        QVector<QRgb> palette;
-        if (parser.isSet("thumb")) {
-            std::string paletteData((const char*)ta::PALETTE, sizeof(ta::PALETTE));
-            try
-            {
-                LOG_DEBUG("  loading palette");
-                const HpiEntry &hpiEntry = paletteFiles.at("palettes/PALETTE.PAL");
-                paletteData = hpiLoad(hpiEntry);
-            }
-            catch (std::out_of_range&)
-            {
-                LOG_DEBUG("  out_of_range loading palette. using hard coded palette");
-            }
-            catch (...)
+            LOG_DEBUG("--- loading features from hpi archives ...");
+            QString featureFileCacheFile(featuresCacheDir + "/" + "tafeatures.files");
+            FeatureFileCache cachedFeatureFiles;
+            if (parser.isSet("featurescachedir"))
             {
-                LOG_DEBUG("  unknown exception loading palette. using hard coded palette");
+                cachedFeatureFiles = loadFeatureFileCache(featureFileCacheFile);
             }
-            palette = loadPalette(paletteData);
-        }
 
-        for (const auto &p : mapFiles)
-        {
-            try
+            std::size_t parsedCount = 0u;
+            ta::TdfFile interestingFeatures;
+            auto itKey = featureKeys.begin();
+            for (const auto& p : featureFiles)
             {
-                QFileInfo fileInfo(p.second.filePath.c_str());
-                if (fileInfo.suffix().toLower() == "tnt")
+                const rwe::HpiContentCache::Key& key = *itKey++;
+                auto itCached = cachedFeatureFiles.find(key);
+                if (itCached == cachedFeatureFiles.end())
                 {
-                    LOG_DEBUG("--- processing map file " << p.second.filePath);
-                    std::string otaFileName = otaFileNameLookup[fileInfo.baseName()];
-                    std::string tntData, otaData;
-
-                    const HpiEntry &mapFileHpiEntry = mapFiles.at(otaFileName);
-                    tntData = hpiLoad(p.second);
-                    otaData = hpiLoad(mapFileHpiEntry);
-
-                    if (doHash)
+                    try
+                    {
+                        itCached = cachedFeatureFiles.emplace(key, loadInterestingFeatures(p.second)).first;
+                        ++parsedCount;
+                    }
+                    catch (const std::exception& e)
                     {
-                        LOG_DEBUG("  calculating .tnt part of CRC");
-                        std::uint32_t crc(-1);
-                        crc32.PartialCRC(&crc, (const std::uint8_t*)tntData.data(), tntData.size());
-                        crcByMap[fileInfo.baseName().toStdString()] = crc;
+                        LOG_DEBUG("  exception loading/parsing file:" << e.what());
+                        continue;
                     }
-                    if (parser.isSet("thumb"))
+                    catch (...)
                     {
-                        QStringList thumbTypes = parser.value("thumbtypes").split(',');
-                        const int maxPositions = parser.value("maxpositions").toInt();
-
-                        // Image thumbnails: everything except the coordinate side-car.
-                        QStringList imageTypes;
-                        for (const QString& t : thumbTypes)
-                        {
-                            if (t != "positions-coords")
-                            {
-                                imageTypes.append(t);
-                            }
-                        }
-                        if (!imageTypes.isEmpty())
-                        {
-                            LOG_DEBUG("  generating map images");
-                            auto images = createMapImages(tntData, otaData, allFeatures, palette, imageTypes, maxPositions, parser.value("thumbsize").toInt());
-                            LOG_DEBUG("  saving map images");
-                            saveMapImages(fileInfo, parser.value("thumb"), images);
-                        }
-
-                        // Start-position coordinate side-car (text), consumed by the client
-                        // to draw its own position markers rather than a rendered overlay.
-                        if (thumbTypes.contains("positions-coords"))
-                        {
-                            LOG_DEBUG("  generating start-position coordinates");
-                            QString data = createStartPositionsData(tntData, otaData, maxPositions);
-                            saveStartPositionsData(fileInfo, parser.value("thumb"), maxPositions, data);
-                        }
+                        LOG_DEBUG("  exception loading/parsing file");
+                        continue;
                     }
                 }
+
+                // later files override earlier ones' features of the same name, as they always have
+                for (const auto& f : itCached->second.children)
+                {
+                    interestingFeatures.children[f.first] = f.second;
+                }
             }
-            catch (const std::exception & e)
-            {
-                LOG_DEBUG("  exception processing map file " << p.second.archivePath << '/' << p.second.filePath << ":" << e.what());
-                continue;
-            }
-            catch (...)
+            LOG_DEBUG("  feature files:" << featureFiles.size() << ", parsed:" << parsedCount);
+
+            // features are only ever looked up from here on, so flatten them for faster lookups
+            allFeatures.reset(new ta::FlatTdfFile(interestingFeatures));
+            if (parser.isSet("featurescachedir"))
             {
-                LOG_DEBUG("  unknown exception processing map file " << p.second.archivePath << '/' << p.second.filePath);
-                continue;
+                // stale files are dropped, rather than those this run didn't use, so the cache doesn't grow
+                // with every mod version ever installed, yet still serves other gamepaths and hpispecs
+                if (dropStaleFeatureFiles(cachedFeatureFiles) > 0u || parsedCount > 0u)
+                {
+                    LOG_DEBUG("--- saving feature file cache. filename=" << featureFileCacheFile.toStdString());
+                    saveFeatureFileCache(featureFileCacheFile, cachedFeatureFiles);
+                }
+
+                LOG_DEBUG("--- saving features to cache. filename=" << allFeaturesCacheFile.toStdString() << ", children:" << interestingFeatures.children.size());
+                std::ostringstream ss;
+                allFeatures->serialise(ss);
+                std::string bytes = ss.str();
+                QSaveFile file(allFeaturesCacheFile);
+                if (!file.open(QIODevice::WriteOnly) || file.write(bytes.data(), bytes.size()) != qint64(bytes.size()) || !file.commit())
+                {
+                    LOG_DEBUG("  unable to save features cache");
+                }
             }
         }
     }
+    else
+    {
+        allFeatures.reset(new ta::FlatTdfFile());
+    }
 
-    std::map<QString, HpiEntry> tntFileNameLookup;
+    MapJobSettings settings;
+    settings.doHash = doHash;
+    settings.doSql = parser.isSet("sql");
+    settings.doThumb = parser.isSet("thumb");
+    settings.thumbDir = parser.value("thumb");
+    settings.thumbTypes = parser.value("thumbtypes").split(',');
+    settings.maxPositions = parser.value("maxpositions").toInt();
+    settings.thumbSize = parser.value("thumbsize").toInt();
+    settings.thumbPyramid = thumbPyramid;
+    settings.allFeatures = allFeatures.get();
+    settings.crc32 = &crc32;
+    settings.pool = &pool;
+
+    if (settings.doThumb) {
+        std::string paletteData((const char*)ta::PALETTE, sizeof(ta::PALETTE));
+        try
+        {
+            LOG_DEBUG("  loading palette");
+            const HpiEntry &hpiEntry = paletteFiles.at("palettes/PALETTE.PAL");
+            paletteData = hpiLoad(hpiEntry);
+        }
+        catch (std::out_of_range&)
+        {
+            LOG_DEBUG("  out_of_range loading palette. using hard coded palette");
+        }
+        catch (...)
+        {
+            LOG_DEBUG("  unknown exception loading palette. using hard coded palette");
+        }
+        settings.palette = loadPalette(paletteData);
+    }
+
+    std::map<QString, const HpiEntry*> tntFileNameLookup;
     for (const auto &p : mapFiles)
     {
         QFileInfo fileInfo(p.second.filePath.c_str());
         if (fileInfo.suffix().toLower() == "tnt")
         {
-            tntFileNameLookup[fileInfo.baseName()] = p.second;
+            tntFileNameLookup[fileInfo.baseName()] = &p.second;
         }
     }
 
+    // each map is independent, so farm them out, but print in map order
+    std::vector<std::future<std::string> > listings;
     for (const auto &p : mapFiles)
     {
-        try
-        {
-            QFileInfo fileInfo(p.second.filePath.c_str());
-            if (fileInfo.suffix().toLower() == "ota")
-            {
-
-                std::string data = hpiLoad(p.second);
-                bool isSkirmish = isSkirmishMap(data);
-                if (!isSkirmish)
-                {
-                    LOG_DEBUG("  not a skirmish map. ignoring");
-                    continue;
-                }
-
-                std::uint32_t& crc = crcByMap[fileInfo.baseName().toStdString()];
-                if (doHash)
-                {
-                    LOG_DEBUG("  calculating .ota part of CRC");
-                    crc32.PartialCRC(&crc, (const std::uint8_t*)data.data(), data.size());
-                    crc ^= -1;
-                }
-
-                LOG_DEBUG("  parsing .ota file");
-                ta::TdfFile tdf(data, 1);
-                if (parser.isSet("sql"))
-                {
-                    LOG_DEBUG("  listing file (sql)");
-                    sqlMap(std::cout, fileInfo.baseName().toStdString(), p.second.archivePath, tdf, crc);
-                }
-                else
-                {
-                    LOG_DEBUG("  listing file (delimited text)");
-                    lsMap(std::cout, fileInfo.baseName().toStdString(), p.second.archivePath, tdf, doHash ? crc : 0u);
-                }
-            }
-        }
-        catch (const std::exception & e)
+        QFileInfo fileInfo(p.second.filePath.c_str());
+        if (fileInfo.suffix().toLower() != "ota")
         {
-            LOG_DEBUG("  exception generating hash for map file " << p.second.archivePath << '/' << p.second.filePath << ":" << e.what());
             continue;
         }
-        catch (...)
+
+        const HpiEntry& otaEntry = p.second;
+        auto itTnt = tntFileNameLookup.find(fileInfo.baseName());
+        const HpiEntry* tntEntry = itTnt != tntFileNameLookup.end() ? itTnt->second : nullptr;
+        listings.push_back(pool.submit([&settings, &otaEntry, fileInfo, tntEntry]()
         {
-            LOG_DEBUG("  unknown exception generating hash for map file " << p.second.archivePath << '/' << p.second.filePath);
-            continue;
-        }
+            try
+            {
+                return MapJob(settings, fileInfo, otaEntry, tntEntry).run();
+            }
+            catch (const std::exception & e)
+            {
+                LOG_ERROR("unable to process map file " << otaEntry.archivePath << '/' << otaEntry.filePath << ": " << e.what());
+            }
+            catch (...)
+            {
+                LOG_ERROR("unable to process map file " << otaEntry.archivePath << '/' << otaEntry.filePath);
+            }
+            return std::string();
+        }));
+    }
+
+    for (std::future<std::string>& listing : listings)
+    {
+        std::cout << listing.get();
+    }
+
+    if (contentCache)
+    {
+        LOG_DEBUG("--- saving content cache manifest");
+        contentCache->save();
     }
 }
@@ -37,7 +37,7 @@ MapTool::MapTool(QString mapToolExePath, QString cacheDirectory):
 
 MapListSignal* MapTool::run(
     QString mapToolExePath, QString gamePath, QString hpiSpecs, QString mapName, bool doCrc,
-    QString previewCacheDirectory, QString previewType, int maxPositions, QString featuresCacheDirectory)
+    QString previewCacheDirectory, QString previewType, int maxPositions, QString featuresCacheDirectory, QString indexCacheDirectory, QString contentCacheDirectory, int jobs)
 {
     QStringList arguments;
     arguments << "--gamepath" << gamePath;
@@ -69,6 +69,18 @@ MapListSignal* MapTool::run(
     {
         arguments << "--featurescachedir" << featuresCacheDirectory;
     }
+    if (!indexCacheDirectory.isEmpty())
+    {
+        arguments << "--indexcachedir" << indexCacheDirectory;
+    }
+    if (!contentCacheDirectory.isEmpty())
+    {
+        arguments << "--contentcachedir" << contentCacheDirectory;
+    }
+    if (jobs != 1)
+    {
+        arguments << "--jobs" << QString::number(jobs);
+    }
 
     MapListSignal* result(new MapListSignal);
     QProcess* process(new QProcess(result));
@@ -129,23 +141,24 @@ MapListSignal* MapTool::run(
 
 MapListSignal* MapTool::listMap(QString gamePath, QString mapName)
 {
-    return run(m_mapToolExePath, gamePath, QString(), mapName + "$", true, QString(), QString(), 0, m_cacheDirectory);
+    return run(m_mapToolExePath, gamePath, QString(), mapName + "$", true, QString(), QString(), 0, m_cacheDirectory, m_cacheDirectory, QDir(m_cacheDirectory).filePath("content"), 1);
 }
 
 MapListSignal* MapTool::listMapsInstalled(QString gamePath, bool doCrc)
 {
-    return run(m_mapToolExePath, gamePath, QString(), QString(), doCrc, QString(), QString(), 0, m_cacheDirectory);
+    return run(m_mapToolExePath, gamePath, QString(), QString(), doCrc, QString(), QString(), 0, m_cacheDirectory, m_cacheDirectory, QDir(m_cacheDirectory).filePath("content"), 1);
 }
 
 MapListSignal* MapTool::listMapsInArchive(QString hpiFile, bool doCrc)
 {
     QFileInfo hpiFileInfo(hpiFile);
-    return run(m_mapToolExePath, hpiFileInfo.dir().absolutePath(), hpiFileInfo.baseName(), QString(), doCrc, m_cacheDirectory, "mini", 0, m_cacheDirectory);
+    return run(m_mapToolExePath, hpiFileInfo.dir().absolutePath(), hpiFileInfo.baseName(), QString(), doCrc, m_cacheDirectory, "mini", 0, m_cacheDirectory, m_cacheDirectory, QDir(m_cacheDirectory).filePath("content"), 1);
 }
 
 MapListSignal* MapTool::generatePreview(QString gamePath, QString mapName, QString previewType, int positionCount)
 {
-    return run(m_mapToolExePath, gamePath, QString(), mapName + "$", false, m_cacheDirectory, previewType, positionCount, m_cacheDirectory);
+    // a single map, so let maptool spread its decompression over every core
+    return run(m_mapToolExePath, gamePath, QString(), mapName + "$", false, m_cacheDirectory, previewType, positionCount, m_cacheDirectory, m_cacheDirectory, QDir(m_cacheDirectory).filePath("content"), 0);
 }
 
 QString MapTool::getPreviewFilePath(QString mapName, QString previewType, int positionCount)
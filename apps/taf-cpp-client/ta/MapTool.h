@@ -36,5 +36,5 @@ private:
 
     static MapListSignal* run(
         QString mapToolExePath, QString gamePath, QString hpiSpecs, QString mapName, bool doCrc,
-        QString previewCacheDirectory, QString previewType, int maxPositions, QString featuresCacheDirectory);
+        QString previewCacheDirectory, QString previewType, int maxPositions, QString featuresCacheDirectory, QString indexCacheDirectory, QString contentCacheDirectory, int jobs);
 };
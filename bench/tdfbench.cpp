@@ -0,0 +1,228 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ta/tdf.h"
+
+// The line/regex based parser ta::TdfFile used before its lexer, kept here as the reference the lexer is checked
+// and timed against. It fills the same public values and children, so the two trees can be compared serialised
+namespace legacy
+{
+    static std::string stripComments(const std::string& text)
+    {
+        std::string result;
+        result.reserve(text.size());
+
+        bool isComment = false;
+        for (std::size_t i = 0u; i < text.size(); ++i)
+        {
+            if (isComment && text[i] == '\n')
+            {
+                isComment = false;
+                result += '\n';
+            }
+            else if (!isComment && text[i] == '/' && i+1<text.size() && text[i+1] == '/')
+            {
+                isComment = true;
+            }
+            else if (!isComment)
+            {
+                result += text[i];
+            }
+        }
+
+        return result;
+    }
+
+    static std::string trim(const std::string& s) {
+        static std::regex e("^\\s+|\\s+$");   // remove leading and trailing spaces. NB regex compilation very slow on mingw, so keep it static!
+        return std::regex_replace(s, e, "");
+    }
+
+    static std::size_t tdfParse(ta::TdfFile& tdf, const std::string& text, std::size_t pos, int maxDepth)
+    {
+        int braceDepth = 0;
+
+        while(pos < text.size())
+        {
+            std::string line;
+            std::size_t posNL = text.find_first_of('\n', pos);
+            if (posNL != std::string::npos)
+            {
+                line = text.substr(pos, posNL - pos);
+                pos = 1u+posNL;
+            }
+            else
+            {
+                line = text.substr(pos);
+                pos = text.size();
+            }
+
+            line = trim(line);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            std::size_t posEquals = line.find_first_of('=');
+            if (line.size()>2 && line.front() == '[' && line.back() == ']')
+            {
+                if (maxDepth > 0)
+                {
+                    std::string subHeading = line.substr(1, line.size() - 2);
+                    pos = tdfParse(tdf.children[subHeading], text, pos, maxDepth - 1);
+                }
+                else
+                {
+                    return text.size();
+                }
+            }
+            else if (line == "{")
+            {
+                ++braceDepth;
+            }
+            else if (line == "}")
+            {
+                --braceDepth;
+            }
+            else if (posEquals != std::string::npos)
+            {
+                std::string key = trim(line.substr(0, posEquals));
+                std::string value = trim(line.substr(posEquals + 1));
+                // the original read before the front of an empty value here; the lexer leaves it empty
+                if (!value.empty() && value.back() == ';')
+                {
+                    value = value.substr(0, value.size() - 1);
+                }
+                tdf.values[key] = value;
+            }
+
+            if (braceDepth == 0)
+            {
+                return pos;
+            }
+        }
+        return pos;
+    }
+
+    static ta::TdfFile parse(const std::string& _text, int maxDepth)
+    {
+        ta::TdfFile tdf;
+        std::string text = stripComments(_text);
+        std::size_t pos = 0u;
+        do
+        {
+            pos = tdfParse(tdf, text, pos, maxDepth);
+        }
+        while (pos < text.size());
+        return tdf;
+    }
+}
+
+static std::string serialised(const ta::TdfFile& tdf)
+{
+    std::ostringstream ss;
+    tdf.serialise(ss);
+    return ss.str();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("tdfbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Parses TDF files (e.g. a game's extracted features directory) with both ta::TdfFile and the legacy parser, and reports how long each took and whether they ever disagreed");
+    parser.addHelpOption();
+    parser.addPositionalArgument("paths", "TDF files, or directories searched recursively for *.tdf", "paths...");
+    parser.addOption(QCommandLineOption("depth", "maximum section depth to parse", "depth", "1"));
+    parser.addOption(QCommandLineOption("repeat", "parse every file this many times with each parser", "repeat", "1"));
+    parser.process(app);
+
+    const int maxDepth = parser.value("depth").toInt();
+    const int repeat = std::max(1, parser.value("repeat").toInt());
+
+    std::vector<QString> fileNames;
+    for (const QString& path : parser.positionalArguments())
+    {
+        if (QFileInfo(path).isDir())
+        {
+            QDirIterator it(path, QStringList() << "*.tdf", QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext())
+            {
+                fileNames.push_back(it.next());
+            }
+        }
+        else
+        {
+            fileNames.push_back(path);
+        }
+    }
+
+    std::vector<std::string> texts;
+    std::size_t totalBytes = 0u;
+    for (const QString& fileName : fileNames)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            std::cerr << "unable to read " << fileName.toStdString() << std::endl;
+            return 1;
+        }
+        QByteArray bytes = file.readAll();
+        texts.emplace_back(bytes.constData(), bytes.size());
+        totalBytes += texts.back().size();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::string> legacyTrees;
+    for (int r = 0; r < repeat; ++r)
+    {
+        legacyTrees.clear();
+        for (const std::string& text : texts)
+        {
+            legacyTrees.push_back(serialised(legacy::parse(text, maxDepth)));
+        }
+    }
+    qint64 legacyNs = timer.nsecsElapsed();
+
+    timer.restart();
+    std::vector<std::string> lexedTrees;
+    for (int r = 0; r < repeat; ++r)
+    {
+        lexedTrees.clear();
+        for (const std::string& text : texts)
+        {
+            lexedTrees.push_back(serialised(ta::TdfFile(text, maxDepth)));
+        }
+    }
+    qint64 lexerNs = timer.nsecsElapsed();
+
+    std::size_t mismatches = 0u;
+    for (std::size_t n = 0u; n < texts.size(); ++n)
+    {
+        if (legacyTrees[n] != lexedTrees[n])
+        {
+            std::cerr << "parsers disagree on " << fileNames[n].toStdString() << std::endl;
+            ++mismatches;
+        }
+    }
+
+    std::cout << "tdf files:" << texts.size() << ", bytes:" << totalBytes << ", repeat:" << repeat
+        << ", legacy ms:" << legacyNs / 1000000.0
+        << ", lexer ms:" << lexerNs / 1000000.0
+        << ", speedup:" << (lexerNs > 0 ? double(legacyNs) / double(lexerNs) : 0.0)
+        << ", mismatches:" << mismatches << std::endl;
+
+    return mismatches == 0u ? 0 : 1;
+}
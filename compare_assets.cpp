@@ -6,50 +6,157 @@
 #include <QDirIterator>
 #include <QFile>
 #include <QRegularExpression>
+#include <QSaveFile>
+#include <fstream>
+#include <future>
 #include <memory>
 #include <map>
-#include <vector>
 #include <sstream>
+#include <vector>
 
 #include "rwe/hpi/HpiArchive.h"
+#include "rwe/hpi/hpi_cache_io.h"
+#include "rwe/ThreadPool.h"
+#include "rwe/MemoryMappedFile.h"
 #include "nswf/nswfl_crc32.h"
 
-// Helper function to compute CRC32 using Qt's implementation
-QString computeCrc32(const QByteArray& data)
+// Helper function to format a CRC32 as 8 hex digits, most significant first
+QString formatCrc32(unsigned crc32)
+{
+    return QString("%1").arg(crc32, 8, 16, QChar('0'));
+}
+
+// Helper function to compute CRC32 of bytes in place
+unsigned computeCrc32(const char* data, std::size_t size)
 {
     NSWFL::Hashing::CRC32 hasher;
-    unsigned crc32 = hasher.FullCRC((const unsigned char*)data.data(), data.size());
-    QByteArray ba((const char*)&crc32, 4);
-    std::reverse(ba.begin(), ba.end());
-    return QString(ba.toHex());
+    return hasher.FullCRC((const unsigned char*)data, size);
 }
 
-// Helper function to process archive files
-void processArchive(const QString& archivePath, const QString& pattern, std::multimap<QString, QString>& targetMap)
+// The matching files of one archive and their CRC32s, as of the archive's size and timestamp.
+// This per-archive index is compare_assets' only cache. rwe::HpiContentCache keys its entries on the archive's size and
+// timestamp too, so it could only hit where this index already does, and would still have every archive opened and walked
+struct ArchiveIndex
+{
+    qint64 size = -1;
+    qint64 modified = -1;
+    std::string pattern;
+    std::vector<std::pair<unsigned, std::string> > files;   // crc, path within the archive
+};
+
+static const std::uint32_t CrcIndexMagicNumber = 0x58435243; // "CRCX"
+static const std::uint32_t CrcIndexVersion = 1;
+
+// Helper function to load the archive indices saved by a previous run. Missing or unreadable files give an empty index
+std::map<std::string, ArchiveIndex> loadCrcIndex(const QString& fileName)
 {
-    QFile archiveFile(archivePath);
-    if (!archiveFile.open(QIODevice::ReadOnly))
+    std::map<std::string, ArchiveIndex> indices;
+    std::ifstream ifs(fileName.toStdString(), std::ios::binary);
+    if (!ifs)
     {
-        qWarning() << "Failed to open archive:" << archivePath;
+        return indices;
+    }
+
+    try
+    {
+        if (rwe::readCacheRaw<std::uint32_t>(ifs) != CrcIndexMagicNumber || rwe::readCacheRaw<std::uint32_t>(ifs) != CrcIndexVersion)
+        {
+            qWarning() << "Ignoring incompatible CRC index" << fileName;
+            return indices;
+        }
+
+        std::uint32_t archiveCount = rwe::readCacheRaw<std::uint32_t>(ifs);
+        for (std::uint32_t n = 0u; n < archiveCount; ++n)
+        {
+            std::string archivePath = rwe::readCacheString(ifs);
+            ArchiveIndex& index = indices[archivePath];
+            index.size = rwe::readCacheRaw<qint64>(ifs);
+            index.modified = rwe::readCacheRaw<qint64>(ifs);
+            index.pattern = rwe::readCacheString(ifs);
+            std::uint32_t fileCount = rwe::readCacheRaw<std::uint32_t>(ifs);
+            for (std::uint32_t m = 0u; m < fileCount; ++m)
+            {
+                unsigned crc32 = rwe::readCacheRaw<std::uint32_t>(ifs);
+                index.files.emplace_back(crc32, rwe::readCacheString(ifs));
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        qWarning() << "Ignoring unreadable CRC index" << fileName << ":" << e.what();
+        indices.clear();
+    }
+    return indices;
+}
+
+// Helper function to save the archive indices for the next run
+void saveCrcIndex(const QString& fileName, const std::map<std::string, ArchiveIndex>& indices)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Failed to save CRC index:" << fileName;
         return;
     }
 
-    QByteArray archiveData = archiveFile.readAll();
-    archiveFile.close();
+    std::ostringstream os;
+    rwe::writeCacheRaw(os, CrcIndexMagicNumber);
+    rwe::writeCacheRaw(os, CrcIndexVersion);
+    rwe::writeCacheRaw<std::uint32_t>(os, indices.size());
+    for (const auto& p : indices)
+    {
+        rwe::writeCacheString(os, p.first);
+        rwe::writeCacheRaw(os, p.second.size);
+        rwe::writeCacheRaw(os, p.second.modified);
+        rwe::writeCacheString(os, p.second.pattern);
+        rwe::writeCacheRaw<std::uint32_t>(os, p.second.files.size());
+        for (const auto& f : p.second.files)
+        {
+            rwe::writeCacheRaw<std::uint32_t>(os, f.first);
+            rwe::writeCacheString(os, f.second);
+        }
+    }
+
+    std::string data = os.str();
+    file.write(data.data(), data.size());
+    if (!file.commit())
+    {
+        qWarning() << "Failed to save CRC index:" << fileName;
+    }
+}
+
+// Helper function to process archive files
+// Returns false if the archive couldn't be read, in which case it isn't indexed
+bool processArchive(const QString& archivePath, const QString& pattern, ArchiveIndex& index)
+{
+    std::unique_ptr<rwe::MemoryMappedFile> archiveFile;
+    try
+    {
+        archiveFile = std::make_unique<rwe::MemoryMappedFile>(archivePath.toStdString());
+    }
+    catch (const std::exception& e)
+    {
+        qWarning() << "Failed to open archive:" << archivePath << ":" << e.what();
+        return false;
+    }
 
-    std::stringstream archiveStream(std::string(archiveData.constData(), archiveData.size()));
     std::unique_ptr<rwe::HpiArchive> archive;
 
     try
     {
-        archive = std::make_unique<rwe::HpiArchive>(&archiveStream);
+        archive = std::make_unique<rwe::HpiArchive>(archiveFile->data(), archiveFile->size());
     }
     catch (const std::exception& e)
     {
         qWarning() << "Failed to parse archive" << archivePath << ":" << e.what();
-        return;
+        return false;
     }
 
+    QRegularExpression re(pattern, QRegularExpression::CaseInsensitiveOption);
+
+    // one buffer for the whole archive, grown to its largest file
+    std::vector<char> buffer;
+
     // Recursive function to process directory entries
     std::function<void(const rwe::HpiArchive::Directory&, const QString&)> processDirectory;
     processDirectory = [&](const rwe::HpiArchive::Directory& dir, const QString& currentPath)
@@ -62,22 +169,19 @@ void processArchive(const QString& archivePath, const QString& pattern, std::mul
             {
                 // Check if file matches pattern
                 QFileInfo fileInfo(fullPath);
-                if (!fileInfo.fileName().contains(QRegularExpression(pattern, QRegularExpression::CaseInsensitiveOption)))
+                if (!fileInfo.fileName().contains(re))
                 {
                     //qDebug() << "no match" << archivePath << fullPath;
                     continue;
                 }
 
-                // Read file contents
-                std::vector<char> buffer(entry.file->size);
+                // Read file contents and hash them where they land
+                if (buffer.size() < entry.file->size)
+                {
+                    buffer.resize(entry.file->size);
+                }
                 archive->extract(*entry.file, buffer.data());
-
-                // Calculate CRC32 using Qt's implementation
-                QByteArray fileData(buffer.data(), buffer.size());
-                QString crc = computeCrc32(fileData);
-
-                // Add to map
-                targetMap.insert({ crc, archivePath + ":" + fullPath });
+                index.files.emplace_back(computeCrc32(buffer.data(), entry.file->size), fullPath.toStdString());
                 //qDebug() << "match" << archivePath << fullPath;
             }
             else if (entry.directory)
@@ -87,7 +191,16 @@ void processArchive(const QString& archivePath, const QString& pattern, std::mul
         }
     };
 
-    processDirectory(archive->root(), "");
+    try
+    {
+        processDirectory(archive->root(), "");
+    }
+    catch (const std::exception& e)
+    {
+        qWarning() << "Failed to extract from archive" << archivePath << ":" << e.what();
+        return false;
+    }
+    return true;
 }
 
 int main(int argc, char* argv[])
@@ -105,6 +218,9 @@ int main(int argc, char* argv[])
     parser.addPositionalArgument("target", "Target directory containing archives to scan");
     parser.addPositionalArgument("mod", "show match results only where Target directory (or substring of) is exclusively this parameter. ie where the source file is ONLY found in this target subdirectory. can be a ; seperated list");
 
+    parser.addOption(QCommandLineOption("cachedir", "Keep an index of the matching files of each archive and their CRC32s in this directory (as crcindex), so unchanged archives aren't opened again", "cachedir"));
+    parser.addOption(QCommandLineOption("jobs", "number of archives/source files to hash concurrently. 0 for one per CPU core.", "jobs", "0"));
+
     parser.process(app);
 
     const QStringList args = parser.positionalArguments();
@@ -113,6 +229,17 @@ int main(int argc, char* argv[])
         parser.showHelp(1);
     }
 
+    rwe::ThreadPool pool(rwe::ThreadPool::threadCountForJobs(parser.value("jobs").toInt()));
+
+    QString crcIndexFileName;
+    std::map<std::string, ArchiveIndex> crcIndex;
+    if (parser.isSet("cachedir"))
+    {
+        QDir().mkpath(parser.value("cachedir"));
+        crcIndexFileName = QDir(parser.value("cachedir")).filePath("crcindex");
+        crcIndex = loadCrcIndex(crcIndexFileName);
+    }
+
     QString sourceRoot = args[0];
     QString targetRoot = args[1];
     QStringList targetMods = args[2].split(';');
@@ -127,6 +254,7 @@ int main(int argc, char* argv[])
     QStringList archiveExtensions = { ".ccx", ".hpi", ".gp3", ".ufo" };
 
     QDir targetDir(targetRoot);
+    QStringList archivePaths;
 
     // First process archives in the root directory
     foreach(const QString & ext, archiveExtensions)
@@ -134,9 +262,7 @@ int main(int argc, char* argv[])
         QStringList archives = targetDir.entryList(QStringList() << "*" + ext, QDir::Files);
         foreach(const QString & archive, archives)
         {
-            QString archivePath = targetDir.filePath(archive);
-            qInfo() << "Processing archive:" << archivePath;
-            processArchive(archivePath, rePattern, targetMap);
+            archivePaths.append(targetDir.filePath(archive));
         }
     }
 
@@ -150,13 +276,86 @@ int main(int argc, char* argv[])
             QStringList archives = subTargetDir.entryList(QStringList() << "*" + ext, QDir::Files);
             foreach(const QString & archive, archives)
             {
-                QString archivePath = subTargetDir.filePath(archive);
-                qInfo() << "Processing archive:" << archivePath;
-                processArchive(archivePath, rePattern, targetMap);
+                archivePaths.append(subTargetDir.filePath(archive));
+            }
+        }
+    }
+
+    // Hash new or changed archives concurrently, then merge everything in archive order
+    std::vector<std::future<std::unique_ptr<ArchiveIndex> > > pending;
+    foreach(const QString & archivePath, archivePaths)
+    {
+        QFileInfo archiveInfo(archivePath);
+        qint64 size = archiveInfo.size();
+        qint64 modified = archiveInfo.lastModified().toMSecsSinceEpoch();
+
+        auto cached = crcIndex.find(archivePath.toStdString());
+        if (cached != crcIndex.end() && cached->second.size == size && cached->second.modified == modified && cached->second.pattern == rePattern.toStdString())
+        {
+            pending.push_back(std::future<std::unique_ptr<ArchiveIndex> >());
+            continue;
+        }
+
+        pending.push_back(pool.submit([archivePath, rePattern, size, modified]() {
+            std::unique_ptr<ArchiveIndex> index(new ArchiveIndex);
+            index->size = size;
+            index->modified = modified;
+            index->pattern = rePattern.toStdString();
+            if (!processArchive(archivePath, rePattern, *index))
+            {
+                index.reset();
+            }
+            return index;
+        }));
+    }
+
+    bool crcIndexChanged = false;
+    for (int n = 0; n < archivePaths.size(); ++n)
+    {
+        const QString& archivePath = archivePaths[n];
+        std::string key = archivePath.toStdString();
+        if (pending[n].valid())
+        {
+            qInfo() << "Processing archive:" << archivePath;
+            std::unique_ptr<ArchiveIndex> index = pending[n].get();
+            crcIndexChanged = true;
+            if (!index)
+            {
+                crcIndex.erase(key);
+                continue;
             }
+            crcIndex[key] = std::move(*index);
+        }
+        else
+        {
+            qInfo() << "Processing archive (cached):" << archivePath;
+        }
+
+        for (const auto& f : crcIndex[key].files)
+        {
+            targetMap.insert({ formatCrc32(f.first), archivePath + ":" + QString::fromStdString(f.second) });
+        }
+    }
+
+    // archives that have gone since they were indexed would otherwise be kept forever
+    for (auto it = crcIndex.begin(); it != crcIndex.end();)
+    {
+        if (QFile::exists(QString::fromStdString(it->first)))
+        {
+            ++it;
+        }
+        else
+        {
+            it = crcIndex.erase(it);
+            crcIndexChanged = true;
         }
     }
 
+    if (!crcIndexFileName.isEmpty() && crcIndexChanged)
+    {
+        saveCrcIndex(crcIndexFileName, crcIndex);
+    }
+
     // Check source files
     QDir sourceDir(sourceRoot);
     QFileInfoList sourceFiles;
@@ -169,18 +368,34 @@ int main(int argc, char* argv[])
         sourceFiles.append(QFileInfo(it.next()));
     }
 
+    // Hash source files concurrently, straight out of their mappings
+    std::vector<std::future<QString> > sourceCrcs;
     foreach(const QFileInfo & fileInfo, sourceFiles)
     {
-        QFile file(fileInfo.absoluteFilePath());
-        if (!file.open(QIODevice::ReadOnly))
+        QString sourcePath = fileInfo.absoluteFilePath();
+        sourceCrcs.push_back(pool.submit([sourcePath]() {
+            try
+            {
+                rwe::MemoryMappedFile file(sourcePath.toStdString());
+                return formatCrc32(computeCrc32(file.data(), file.size()));
+            }
+            catch (const std::exception& e)
+            {
+                qWarning() << "Failed to open source file:" << sourcePath << ":" << e.what();
+                return QString();
+            }
+        }));
+    }
+
+    for (int n = 0; n < sourceFiles.size(); ++n)
+    {
+        const QFileInfo& fileInfo = sourceFiles[n];
+        QString crc = sourceCrcs[n].get();
+        if (crc.isEmpty())
         {
-            qWarning() << "Failed to open source file:" << fileInfo.absoluteFilePath();
             continue;
         }
 
-        QByteArray fileData = file.readAll();
-        QString crc = computeCrc32(fileData);
-
         bool isExclusive = true;
         for (int pass = 0; pass < 2; ++pass)
         {
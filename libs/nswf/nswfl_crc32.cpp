@@ -14,6 +14,23 @@
 #include <memory>
 #include <cstring>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <arm_acle.h>
+#endif
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 #ifdef _USE_GLOBAL_MEMPOOL
 extern NSWFL::Memory::MemoryPool *pMem; //pMem must be defined and initalized elsewhere.
 #endif
@@ -60,15 +77,32 @@ namespace NSWFL {
 			// 256 values representing ASCII character codes.
 			for (int iCodes = 0; iCodes <= 0xFF; iCodes++)
 			{
-				this->iTable[iCodes] = this->Reflect(iCodes, 8) << 24;
+				this->iTable[0][iCodes] = this->Reflect(iCodes, 8) << 24;
 
 				for (int iPos = 0; iPos < 8; iPos++)
 				{
-					this->iTable[iCodes] = (this->iTable[iCodes] << 1)
-						^ ((this->iTable[iCodes] & (1 << 31)) ? iPolynomial : 0);
+					this->iTable[0][iCodes] = (this->iTable[0][iCodes] << 1)
+						^ ((this->iTable[0][iCodes] & (1 << 31)) ? iPolynomial : 0);
 				}
 
-				this->iTable[iCodes] = this->Reflect(this->iTable[iCodes], 32);
+				this->iTable[0][iCodes] = this->Reflect(this->iTable[0][iCodes], 32);
+			}
+
+			// Table n gives the CRC of a byte followed by n zero bytes, so eight bytes can be looked up at once.
+			for (int iSlice = 1; iSlice < 8; iSlice++)
+			{
+				for (int iCodes = 0; iCodes <= 0xFF; iCodes++)
+				{
+					unsigned int iPrevious = this->iTable[iSlice - 1][iCodes];
+					this->iTable[iSlice][iCodes] = (iPrevious >> 8) ^ this->iTable[0][iPrevious & 0xFF];
+				}
+			}
+
+			// x^1, then repeated squaring gives x^2, x^4, x^8, ...
+			this->iPowers[0] = 1u << 30;
+			for (int iPower = 1; iPower < 32; iPower++)
+			{
+				this->iPowers[iPower] = this->MultiplyModP(this->iPowers[iPower - 1], this->iPowers[iPower - 1]);
 			}
 		}
 
@@ -95,22 +129,265 @@ namespace NSWFL {
 			return iValue;
 		}
 
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/*
+			Hardware CRC engines. Each one advances *iCRC over a prefix of sData and returns how many
+				bytes it consumed, leaving the rest to the table driven loop. They are only compiled for
+				CPUs that might have the instructions, and only used once the running CPU is seen to have them.
+		*/
+
+		typedef size_t (*HardwareCRCProc)(unsigned int *iCRC, const unsigned char *sData, size_t iDataLength);
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+		/*
+			Folds 64 bytes at a time with carry-less multiplication, then Barrett reduces to 32 bits.
+				See "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009);
+				the constants are that paper's bit reflected k1..k5, P(x) and mu for the CRC-32 polynomial.
+				Consumes whole 16 byte blocks, and nothing at all below 64 bytes.
+		*/
+#if defined(__GNUC__)
+		__attribute__((target("pclmul,sse4.1")))
+#endif
+		static size_t ClmulCRC(unsigned int *iCRC, const unsigned char *sData, size_t iDataLength)
+		{
+			if (iDataLength < 64)
+			{
+				return 0;
+			}
+
+			const size_t iConsumed = iDataLength & ~(size_t)15;
+			const unsigned char *sEnd = sData + iConsumed;
+
+			const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+			const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+			const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+			const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+			const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+			__m128i x1 = _mm_loadu_si128((const __m128i *)(sData + 0x00));
+			__m128i x2 = _mm_loadu_si128((const __m128i *)(sData + 0x10));
+			__m128i x3 = _mm_loadu_si128((const __m128i *)(sData + 0x20));
+			__m128i x4 = _mm_loadu_si128((const __m128i *)(sData + 0x30));
+			x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)*iCRC));
+			sData += 64;
+
+			// Four lanes of 16 bytes, each folded forward by 64 bytes per step.
+			while (sEnd - sData >= 64)
+			{
+				__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+				__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+				__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+				__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+				x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+				x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+				x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+				x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(sData + 0x00)));
+				x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(sData + 0x10)));
+				x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(sData + 0x20)));
+				x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(sData + 0x30)));
+
+				sData += 64;
+			}
+
+			// Fold the four lanes into one.
+			__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+			x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+			x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+			// Then any remaining 16 byte blocks.
+			while (sData < sEnd)
+			{
+				x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)sData)), x5);
+				sData += 16;
+			}
+
+			// 128 bits down to 64.
+			x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+			x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+			x2 = _mm_srli_si128(x1, 4);
+			x1 = _mm_and_si128(x1, mask32);
+			x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			// Barrett reduction to 32 bits.
+			x2 = _mm_and_si128(x1, mask32);
+			x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+			x2 = _mm_and_si128(x2, mask32);
+			x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			*iCRC = (unsigned int)_mm_extract_epi32(x1, 1);
+			return iConsumed;
+		}
+
+		static HardwareCRCProc SelectHardwareCRC(void)
+		{
+#if defined(_MSC_VER)
+			int iInfo[4];
+			__cpuid(iInfo, 1);
+			bool bClmul = (iInfo[2] & (1 << 1)) != 0;
+			bool bSse41 = (iInfo[2] & (1 << 19)) != 0;
+#else
+			__builtin_cpu_init();
+			bool bClmul = __builtin_cpu_supports("pclmul");
+			bool bSse41 = __builtin_cpu_supports("sse4.1");
+#endif
+			return (bClmul && bSse41) ? ClmulCRC : NULL;
+		}
+
+#elif defined(__aarch64__) || defined(_M_ARM64)
+
+		/*
+			The ARMv8 CRC32 instructions use this very polynomial, so they take the running CRC as is.
+		*/
+#if defined(__GNUC__) && !defined(__ARM_FEATURE_CRC32)
+		__attribute__((target("+crc")))
+#endif
+		static size_t Armv8CRC(unsigned int *iCRC, const unsigned char *sData, size_t iDataLength)
+		{
+			unsigned int iValue = *iCRC;
+			size_t iPos = 0;
+			for (; iPos + 8 <= iDataLength; iPos += 8)
+			{
+				unsigned long long iWord;
+				memcpy(&iWord, sData + iPos, sizeof(iWord));
+				iValue = __crc32d(iValue, iWord);
+			}
+			for (; iPos < iDataLength; iPos++)
+			{
+				iValue = __crc32b(iValue, sData[iPos]);
+			}
+			*iCRC = iValue;
+			return iDataLength;
+		}
+
+		static HardwareCRCProc SelectHardwareCRC(void)
+		{
+#if defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+			return Armv8CRC;
+#elif defined(__linux__)
+			return (getauxval(AT_HWCAP) & HWCAP_CRC32) ? Armv8CRC : NULL;
+#else
+			return NULL;
+#endif
+		}
+
+#else
+
+		static HardwareCRCProc SelectHardwareCRC(void)
+		{
+			return NULL;
+		}
+
+#endif
+
+		static HardwareCRCProc HardwareCRC(void)
+		{
+			static const HardwareCRCProc pProc = SelectHardwareCRC();
+			return pProc;
+		}
+
 		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		/*
 			Calculates the CRC32 by looping through each of the bytes in sData.
+				The CPU's CRC instructions take the bulk of the data when it has them,
+				otherwise eight bytes are folded in per step using the slicing tables.
 
 			Note: For Example usage example, see FileCRC().
 		*/
 
 		void CRC32::PartialCRC(unsigned int *iCRC, const unsigned char *sData, size_t iDataLength) const
 		{
+			HardwareCRCProc pHardwareCRC = HardwareCRC();
+			if (pHardwareCRC != NULL)
+			{
+				size_t iConsumed = pHardwareCRC(iCRC, sData, iDataLength);
+				sData += iConsumed;
+				iDataLength -= iConsumed;
+			}
+
+			unsigned int iValue = *iCRC;
+
+			while (iDataLength >= 8)
+			{
+				unsigned int iLow = iValue ^ ((unsigned int)sData[0] | ((unsigned int)sData[1] << 8)
+					| ((unsigned int)sData[2] << 16) | ((unsigned int)sData[3] << 24));
+				unsigned int iHigh = (unsigned int)sData[4] | ((unsigned int)sData[5] << 8)
+					| ((unsigned int)sData[6] << 16) | ((unsigned int)sData[7] << 24);
+
+				iValue = this->iTable[7][iLow & 0xFF] ^ this->iTable[6][(iLow >> 8) & 0xFF]
+					^ this->iTable[5][(iLow >> 16) & 0xFF] ^ this->iTable[4][iLow >> 24]
+					^ this->iTable[3][iHigh & 0xFF] ^ this->iTable[2][(iHigh >> 8) & 0xFF]
+					^ this->iTable[1][(iHigh >> 16) & 0xFF] ^ this->iTable[0][iHigh >> 24];
+
+				sData += 8;
+				iDataLength -= 8;
+			}
+
 			while (iDataLength--)
 			{
-				//If your compiler complains about the following line, try changing
-				//	each occurrence of *iCRC with ((unsigned int)*iCRC).
+				iValue = (iValue >> 8) ^ this->iTable[0][(iValue & 0xFF) ^ *sData++];
+			}
+
+			*iCRC = iValue;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/*
+			Multiplies two polynomials modulo the CRC-32 polynomial, both bit reflected
+				(bit 31 holds x^0). Used to shift a CRC past a run of zero bytes.
+		*/
 
-				*iCRC = (*iCRC >> 8) ^ this->iTable[(*iCRC & 0xFF) ^ *sData++];
+		unsigned int CRC32::MultiplyModP(unsigned int iA, unsigned int iB) const
+		{
+			unsigned int iProduct = 0;
+
+			for (unsigned int iMask = 1u << 31; iMask != 0; iMask >>= 1)
+			{
+				if (iA & iMask)
+				{
+					iProduct ^= iB;
+				}
+				iB = (iB & 1) ? ((iB >> 1) ^ 0xEDB88320) : (iB >> 1);
 			}
+
+			return iProduct;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/*
+			Returns the CRC32 of A followed by B, given FullCRC() of each and the length of B.
+				Lets a large buffer be hashed in pieces, possibly in parallel, then merged.
+		*/
+
+		unsigned int CRC32::Combine(unsigned int iCRCA, unsigned int iCRCB, size_t iLengthB) const
+		{
+			// Append iLengthB zero bytes to A, i.e. multiply it by x^(8 * iLengthB).
+			unsigned int iShift = 1u << 31;
+			for (int iPower = 3; iLengthB != 0; iLengthB >>= 1, iPower++)
+			{
+				if (iLengthB & 1)
+				{
+					iShift = this->MultiplyModP(this->iPowers[iPower & 31], iShift);
+				}
+			}
+
+			return this->MultiplyModP(iShift, iCRCA) ^ iCRCB;
 		}
 
 		///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,177 @@
+#include "MemoryMappedFile.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rwe
+{
+    MemoryMappedFileException::MemoryMappedFileException(const std::string& message) : runtime_error(message)
+    {
+    }
+
+#ifdef _WIN32
+    MemoryMappedFile::MemoryMappedFile(const std::string& path) : _data(nullptr), _size(0), _modificationTime(0)
+    {
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw MemoryMappedFileException("Unable to open file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            CloseHandle(file);
+            throw MemoryMappedFileException("Unable to get size of file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+
+        FILETIME lastWriteTime;
+        if (!GetFileTime(file, NULL, NULL, &lastWriteTime))
+        {
+            CloseHandle(file);
+            throw MemoryMappedFileException("Unable to get time of file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+
+        _size = static_cast<std::size_t>(fileSize.QuadPart);
+        _modificationTime = static_cast<std::int64_t>((static_cast<std::uint64_t>(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime);
+        if (_size == 0)
+        {
+            // zero length files can't be mapped
+            CloseHandle(file);
+            return;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (mapping == NULL)
+        {
+            throw MemoryMappedFileException("Unable to create mapping for file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+
+        // the view keeps the mapping object alive after its handle is closed
+        _data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (_data == nullptr)
+        {
+            throw MemoryMappedFileException("Unable to map file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+    }
+
+    MemoryMappedFile::~MemoryMappedFile()
+    {
+        if (_data != nullptr)
+        {
+            UnmapViewOfFile(_data);
+        }
+    }
+
+    void statFile(const std::string& path, std::uint64_t& size, std::int64_t& modificationTime)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+        {
+            throw MemoryMappedFileException("Unable to get attributes of file " + path + ", error:" + std::to_string(GetLastError()));
+        }
+
+        size = (static_cast<std::uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+        modificationTime = static_cast<std::int64_t>((static_cast<std::uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime);
+    }
+#else
+    // to the nanosecond, as far as the file system keeps it, so that a rewrite within the same second still shows
+    static std::int64_t modificationTimeOf(const struct stat& st)
+    {
+#ifdef __APPLE__
+        return static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    }
+
+    MemoryMappedFile::MemoryMappedFile(const std::string& path) : _data(nullptr), _size(0), _modificationTime(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw MemoryMappedFileException("Unable to open file " + path + ", errno:" + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            close(fd);
+            throw MemoryMappedFileException("Unable to stat file " + path + ", errno:" + std::strerror(err));
+        }
+
+        _size = static_cast<std::size_t>(st.st_size);
+        _modificationTime = modificationTimeOf(st);
+        if (_size == 0)
+        {
+            // zero length files can't be mapped
+            close(fd);
+            return;
+        }
+
+        // the mapping keeps its own reference to the file, so the descriptor can go straight away
+        void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int err = errno;
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            throw MemoryMappedFileException("Unable to map file " + path + ", errno:" + std::strerror(err));
+        }
+
+        _data = static_cast<const char*>(p);
+    }
+
+    MemoryMappedFile::~MemoryMappedFile()
+    {
+        if (_data != nullptr)
+        {
+            munmap(const_cast<char*>(_data), _size);
+        }
+    }
+
+    void statFile(const std::string& path, std::uint64_t& size, std::int64_t& modificationTime)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+        {
+            throw MemoryMappedFileException("Unable to stat file " + path + ", errno:" + std::strerror(errno));
+        }
+
+        size = static_cast<std::uint64_t>(st.st_size);
+        modificationTime = modificationTimeOf(st);
+    }
+#endif
+
+    const char* MemoryMappedFile::data() const
+    {
+        return _data;
+    }
+
+    std::size_t MemoryMappedFile::size() const
+    {
+        return _size;
+    }
+
+    std::int64_t MemoryMappedFile::modificationTime() const
+    {
+        return _modificationTime;
+    }
+}
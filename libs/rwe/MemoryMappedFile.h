@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace rwe
+{
+    class MemoryMappedFileException : public std::runtime_error
+    {
+    public:
+        explicit MemoryMappedFileException(const std::string& message);
+    };
+
+    /**
+     * A read-only memory mapping of an entire file.
+     * The file handle is released as soon as the mapping is established,
+     * the mapped bytes remain valid for the lifetime of this object.
+     */
+    class MemoryMappedFile
+    {
+    private:
+        const char* _data;
+        std::size_t _size;
+        std::int64_t _modificationTime;
+
+    public:
+        explicit MemoryMappedFile(const std::string& path);
+        ~MemoryMappedFile();
+
+        MemoryMappedFile(const MemoryMappedFile&) = delete;
+        MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+        const char* data() const;
+        std::size_t size() const;
+
+        /**
+         * The file's last write time as of when it was mapped, in platform units
+         * (nanoseconds since the epoch on POSIX, FILETIME ticks on Windows).
+         * Only meaningful for comparison against another value from the same platform.
+         */
+        std::int64_t modificationTime() const;
+    };
+
+    /**
+     * The size and last write time of the file at path, in the same units as MemoryMappedFile reports them,
+     * without opening a mapping. Throws MemoryMappedFileException if the file can't be queried.
+     */
+    void statFile(const std::string& path, std::uint64_t& size, std::int64_t& modificationTime);
+}
@@ -0,0 +1,142 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace rwe
+{
+    ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false)
+    {
+        workers.reserve(threadCount);
+        for (unsigned int i = 0; i < threadCount; ++i)
+        {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    unsigned int ThreadPool::size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    void ThreadPool::forEach(std::size_t count, const std::function<void(std::size_t)>& f)
+    {
+        if (workers.empty() || count < 2)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                f(i);
+            }
+            return;
+        }
+
+        struct SharedState
+        {
+            const std::function<void(std::size_t)>* f;
+            std::size_t count;
+            std::atomic<std::size_t> next{ 0 };
+            std::mutex mutex;
+            std::condition_variable finishedCondition;
+            std::size_t finished = 0;
+            std::size_t errorIndex = 0;
+            std::exception_ptr error;
+        };
+
+        auto state = std::make_shared<SharedState>();
+        state->f = &f;
+        state->count = count;
+
+        // helpers that only get to run once everything is done find nothing left, and touch nothing but state
+        auto work = [state]()
+        {
+            std::size_t i;
+            while ((i = state->next++) < state->count)
+            {
+                std::exception_ptr error;
+                try
+                {
+                    (*state->f)(i);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (error && (!state->error || i < state->errorIndex))
+                {
+                    state->error = std::move(error);
+                    state->errorIndex = i;
+                }
+                if (++state->finished == state->count)
+                {
+                    state->finishedCondition.notify_all();
+                }
+            }
+        };
+
+        std::size_t helpers = std::min<std::size_t>(workers.size(), count - 1);
+        for (std::size_t i = 0; i < helpers; ++i)
+        {
+            submit(work);
+        }
+        work();
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->finishedCondition.wait(lock, [&state]() { return state->finished == state->count; });
+            error = std::move(state->error);
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    unsigned int ThreadPool::threadCountForJobs(int jobs)
+    {
+        if (jobs == 0)
+        {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            return hardwareThreads > 1 ? hardwareThreads : 0;
+        }
+
+        return jobs > 1 ? static_cast<unsigned int>(jobs) : 0;
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+}
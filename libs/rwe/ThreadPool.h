@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rwe
+{
+    /**
+     * A fixed set of worker threads servicing a FIFO queue of tasks.
+     * A pool created with zero threads runs each task synchronously inside submit(),
+     * so callers can use the same code path for serial and parallel operation.
+     */
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping;
+
+    public:
+        explicit ThreadPool(unsigned int threadCount);
+
+        /** Finishes all queued tasks, then joins the workers. */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /** The number of worker threads, zero if tasks run synchronously. */
+        unsigned int size() const;
+
+        /**
+         * Queues f for execution. Any exception thrown by f is delivered
+         * through the returned future.
+         */
+        template <typename F>
+        std::future<std::invoke_result_t<F>> submit(F f)
+        {
+            using R = std::invoke_result_t<F>;
+            auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+            std::future<R> result = task->get_future();
+            if (workers.empty())
+            {
+                (*task)();
+                return result;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.emplace_back([task]() { (*task)(); });
+            }
+            condition.notify_one();
+            return result;
+        }
+
+        /**
+         * Calls f(i) for each i in [0, count), spread over the workers and the calling thread,
+         * and returns once all are done.
+         * The calling thread takes part rather than just waiting, so this is safe to call from a task
+         * already running on the pool: if no worker is free, the caller simply does all the work itself.
+         * If several calls throw, the exception rethrown is that of the lowest i.
+         */
+        void forEach(std::size_t count, const std::function<void(std::size_t)>& f);
+
+        /**
+         * Translates a --jobs style request into a worker count:
+         * 0 means one per hardware thread, 1 means run everything on the calling thread.
+         */
+        static unsigned int threadCountForJobs(int jobs);
+
+    private:
+        void workerLoop();
+    };
+}
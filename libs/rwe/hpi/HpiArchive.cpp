@@ -38,7 +38,7 @@ namespace rwe
     HpiArchive::DirectoryEntry
     convertDirectoryEntry(const HpiDirectoryEntry& entry, const char* buffer, std::size_t size)
     {
-        auto nameSize = stringSize(buffer + entry.nameOffset, buffer + size);
+        auto nameSize = entry.nameOffset < size ? stringSize(buffer + entry.nameOffset, buffer + size) : std::string::npos;
         if (nameSize == std::string::npos)
         {
             throw HpiException("Runaway directory entry name");
@@ -69,7 +69,18 @@ namespace rwe
         }
     }
 
-    HpiArchive::HpiArchive(std::istream* stream) : stream(stream)
+    HpiArchive::Directory readRootDirectory(const HpiHeader& h, const char* buffer)
+    {
+        if (h.start + sizeof(HpiDirectoryData) > h.directorySize)
+        {
+            throw HpiException("Runaway root directory");
+        }
+
+        auto directory = reinterpret_cast<const HpiDirectoryData*>(buffer + h.start);
+        return *convertDirectory(*directory, buffer, h.directorySize);
+    }
+
+    HpiArchive::HpiArchive(std::istream* stream) : stream(stream), streamMutex(std::make_shared<std::mutex>()), data(nullptr), dataSize(0)
     {
         auto v = readRaw<HpiVersion>(*stream);
         if (v.marker != HpiMagicNumber)
@@ -90,13 +101,67 @@ namespace rwe
         auto data = std::make_unique<char[]>(h.directorySize);
         readAndDecrypt(*stream, decryptionKey, data.get() + h.start, h.directorySize - h.start);
 
-        if (h.start + sizeof(HpiDirectoryData) > h.directorySize)
+        _root = readRootDirectory(h, data.get());
+    }
+
+    HpiArchive::HpiArchive(const char* data, std::size_t size) : stream(nullptr), data(data), dataSize(size)
+    {
+        if (size < sizeof(HpiVersion) + sizeof(HpiHeader))
         {
-            throw HpiException("Runaway root directory");
+            throw HpiException("Truncated HPI header");
+        }
+
+        HpiVersion v;
+        std::copy(data, data + sizeof(v), reinterpret_cast<char*>(&v));
+        if (v.marker != HpiMagicNumber)
+        {
+            throw HpiException("Invalid HPI file marker");
+        }
+
+        if (v.version != HpiVersionNumber)
+        {
+            throw HpiException("Unsupported HPI version");
         }
 
-        auto directory = reinterpret_cast<HpiDirectoryData*>(data.get() + h.start);
-        _root = *convertDirectory(*directory, data.get(), h.directorySize);
+        HpiHeader h;
+        std::copy(data + sizeof(v), data + sizeof(v) + sizeof(h), reinterpret_cast<char*>(&h));
+
+        decryptionKey = transformKey(static_cast<unsigned char>(h.headerKey));
+
+        if (h.start > h.directorySize || h.directorySize > size)
+        {
+            throw HpiException("Runaway directory");
+        }
+
+        // the directory has to be decrypted, so it is the one part that gets copied
+        auto directoryData = std::make_unique<char[]>(h.directorySize);
+        decrypt(decryptionKey, static_cast<unsigned char>(h.start), data + h.start, directoryData.get() + h.start, h.directorySize - h.start);
+
+        _root = readRootDirectory(h, directoryData.get());
+    }
+
+    HpiArchive::HpiArchive(std::istream* stream, const Directory& root, unsigned char decryptionKey) :
+        stream(stream),
+        streamMutex(std::make_shared<std::mutex>()),
+        data(nullptr),
+        dataSize(0),
+        decryptionKey(decryptionKey),
+        _root(root)
+    {
+    }
+
+    HpiArchive::HpiArchive(const char* data, std::size_t size, const Directory& root, unsigned char decryptionKey) :
+        stream(nullptr),
+        data(data),
+        dataSize(size),
+        decryptionKey(decryptionKey),
+        _root(root)
+    {
+    }
+
+    unsigned char HpiArchive::key() const
+    {
+        return decryptionKey;
     }
 
     const HpiArchive::Directory& HpiArchive::root() const
@@ -106,6 +171,28 @@ namespace rwe
 
     void HpiArchive::extract(const HpiArchive::File& file, char* buffer) const
     {
+        if (data != nullptr)
+        {
+            switch (file.compressionScheme)
+            {
+                case HpiArchive::File::CompressionScheme::None:
+                    if (file.offset > dataSize || dataSize - file.offset < file.size)
+                    {
+                        throw HpiException("Runaway file data");
+                    }
+                    decrypt(decryptionKey, static_cast<unsigned char>(file.offset), data + file.offset, buffer, file.size);
+                    break;
+                case HpiArchive::File::CompressionScheme::LZ77:
+                case HpiArchive::File::CompressionScheme::ZLib:
+                    extractCompressed(data, dataSize, file.offset, decryptionKey, buffer, file.size);
+                    break;
+                default:
+                    throw HpiException("Invalid file entry compression scheme");
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(*streamMutex);
         stream->seekg(file.offset);
         switch (file.compressionScheme)
         {
@@ -121,6 +208,61 @@ namespace rwe
         }
     }
 
+    void HpiArchive::extract(const HpiArchive::File& file, char* buffer, ThreadPool& pool) const
+    {
+        if (data != nullptr && file.compressionScheme != HpiArchive::File::CompressionScheme::None)
+        {
+            extractCompressed(data, dataSize, file.offset, decryptionKey, buffer, file.size, pool);
+            return;
+        }
+
+        extract(file, buffer);
+    }
+
+    void HpiArchive::extractRange(const HpiArchive::File& file, std::size_t offset, std::size_t size, char* buffer) const
+    {
+        if (offset > file.size || file.size - offset < size)
+        {
+            throw HpiException("Read past end of file");
+        }
+
+        if (file.compressionScheme == HpiArchive::File::CompressionScheme::None)
+        {
+            std::size_t begin = file.offset + offset;
+            if (data != nullptr)
+            {
+                if (begin > dataSize || dataSize - begin < size)
+                {
+                    throw HpiException("Runaway file data");
+                }
+                decrypt(decryptionKey, static_cast<unsigned char>(begin), data + begin, buffer, size);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(*streamMutex);
+                stream->seekg(begin);
+                readAndDecrypt(*stream, decryptionKey, buffer, size);
+            }
+            return;
+        }
+
+        if (file.compressionScheme != HpiArchive::File::CompressionScheme::LZ77 &&
+            file.compressionScheme != HpiArchive::File::CompressionScheme::ZLib)
+        {
+            throw HpiException("Invalid file entry compression scheme");
+        }
+
+        if (data != nullptr)
+        {
+            extractCompressedRange(data, dataSize, file.offset, decryptionKey, file.size, offset, buffer, size);
+            return;
+        }
+
+        std::vector<char> whole(file.size);
+        extract(file, whole.data());
+        std::copy(whole.data() + offset, whole.data() + offset + size, buffer);
+    }
+
     const HpiArchive::File* findFileInner(const HpiArchive::Directory& dir, const std::string& name)
     {
         auto it = std::find_if(
@@ -195,4 +337,56 @@ namespace rwe
 
         return dir;
     }
+
+    void HpiArchive::visit(const HpiArchive::File& file, const std::function<void(const char*, std::size_t)>& visitor) const
+    {
+        switch (file.compressionScheme)
+        {
+            case HpiArchive::File::CompressionScheme::None:
+            {
+                // same granularity as a compressed file's chunks
+                std::vector<char> piece(std::min<std::size_t>(file.size, 65536));
+                if (data != nullptr && (file.offset > dataSize || dataSize - file.offset < file.size))
+                {
+                    throw HpiException("Runaway file data");
+                }
+                std::unique_lock<std::mutex> lock;
+                if (data == nullptr)
+                {
+                    lock = std::unique_lock<std::mutex>(*streamMutex);
+                    stream->seekg(file.offset);
+                }
+                for (std::size_t pos = 0; pos < file.size; pos += piece.size())
+                {
+                    std::size_t count = std::min(piece.size(), file.size - pos);
+                    if (data != nullptr)
+                    {
+                        std::size_t begin = file.offset + pos;
+                        decrypt(decryptionKey, static_cast<unsigned char>(begin), data + begin, piece.data(), count);
+                    }
+                    else
+                    {
+                        readAndDecrypt(*stream, decryptionKey, piece.data(), count);
+                    }
+                    visitor(piece.data(), count);
+                }
+                break;
+            }
+            case HpiArchive::File::CompressionScheme::LZ77:
+            case HpiArchive::File::CompressionScheme::ZLib:
+                if (data != nullptr)
+                {
+                    visitCompressed(data, dataSize, file.offset, decryptionKey, file.size, visitor);
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(*streamMutex);
+                    stream->seekg(file.offset);
+                    visitCompressed(*stream, decryptionKey, file.size, visitor);
+                }
+                break;
+            default:
+                throw HpiException("Invalid file entry compression scheme");
+        }
+    }
 }
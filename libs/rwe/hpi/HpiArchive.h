@@ -1,11 +1,15 @@
 #pragma once
 
+#include <functional>
 #include <istream>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace rwe
 {
+    class ThreadPool;
+
     class HpiArchive
     {
     public:
@@ -46,16 +50,64 @@ namespace rwe
 
     private:
         std::istream* stream;
+        std::shared_ptr<std::mutex> streamMutex;    // guards stream's read position
+        const char* data;
+        std::size_t dataSize;
         unsigned char decryptionKey;
         Directory _root;
 
     public:
+        /**
+         * Reads the archive from stream, which must outlive the archive.
+         * Extraction seeks and reads the stream under a lock, so it is safe,
+         * if serialised, to extract from several threads at once.
+         */
         explicit HpiArchive(std::istream* stream);
 
+        /** As above, but binds an already parsed directory and decryption key, as for the in-memory archive below. */
+        HpiArchive(std::istream* stream, const Directory& root, unsigned char decryptionKey);
+
+        /**
+         * Reads the archive from an in-memory image of the whole file,
+         * typically a MemoryMappedFile. Extraction then decrypts and decompresses
+         * straight from those bytes, which must outlive the archive.
+         * Unlike the stream based archive, extract() has no shared read position,
+         * so calls from several threads run in parallel.
+         */
+        HpiArchive(const char* data, std::size_t size);
+
+        /**
+         * Binds an already parsed directory (and its decryption key) to an image of the archive,
+         * skipping header decryption and directory parsing entirely.
+         * The directory must have come from the same, unchanged, archive.
+         */
+        HpiArchive(const char* data, std::size_t size, const Directory& root, unsigned char decryptionKey);
+
+        unsigned char key() const;
+
         const Directory& root() const;
         const File* findFile(const std::string& path) const;
         const Directory* findDirectory(const std::string& path) const;
         void extract(const File& file, char* buffer) const;
+
+        /**
+         * As extract(), but the chunks of a compressed file are decompressed concurrently on pool,
+         * for archives read from memory. Stream based archives extract sequentially.
+         */
+        void extract(const File& file, char* buffer, ThreadPool& pool) const;
+
+        /**
+         * Extracts size bytes of file, starting at offset within it.
+         * For archives read from memory only the chunks covering the range are decompressed.
+         * Stream based archives decompress the whole file and copy the range out of it.
+         */
+        void extractRange(const File& file, std::size_t offset, std::size_t size, char* buffer) const;
+
+        /**
+         * Extracts file a piece at a time, passing each piece to visitor in order, e.g. to hash it.
+         * Nothing bigger than one chunk (64KiB) is held at once, whatever the size of the file.
+         */
+        void visit(const File& file, const std::function<void(const char*, std::size_t)>& visitor) const;
     };
 
 }
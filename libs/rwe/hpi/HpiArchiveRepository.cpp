@@ -0,0 +1,228 @@
+#include "HpiArchiveRepository.h"
+#include "hpi_util.h"
+
+namespace rwe
+{
+    HpiArchiveRepository::HpiArchiveRepository(std::size_t maxOpenArchives, std::uint64_t maxMappedBytes) :
+        maxOpenArchives(maxOpenArchives),
+        maxMappedBytes(maxMappedBytes),
+        mappedBytes(0u),
+        indexCache(nullptr)
+    {
+    }
+
+    void HpiArchiveRepository::setMaxOpenArchives(std::size_t _maxOpenArchives)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxOpenArchives = _maxOpenArchives;
+    }
+
+    void HpiArchiveRepository::setMaxMappedBytes(std::uint64_t _maxMappedBytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxMappedBytes = _maxMappedBytes;
+    }
+
+    void HpiArchiveRepository::setIndexCache(HpiIndexCache* _indexCache)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        indexCache = _indexCache;
+    }
+
+    std::shared_ptr<const HpiArchive> HpiArchiveRepository::touch(Slot& slot)
+    {
+        lru.splice(lru.begin(), lru, slot.lruPosition);
+        return std::shared_ptr<const HpiArchive>(slot.archive, slot.archive->hpi.get());
+    }
+
+    std::list<HpiArchiveRepository::Slot*>::iterator HpiArchiveRepository::evict(std::list<Slot*>::iterator position)
+    {
+        // handles already given out keep the evicted mapping alive until they are released
+        Slot* evicted = *position;
+        mappedBytes -= evicted->archive->file ? evicted->archive->file->size() : 0u;
+        evicted->archive.reset();
+        return lru.erase(position);
+    }
+
+    std::shared_ptr<HpiArchiveRepository::OpenArchive> HpiArchiveRepository::open(const std::string& path, const Slot& slot, HpiIndexCache* cache, bool map)
+    {
+        auto archive = std::make_shared<OpenArchive>();
+        if (map)
+        {
+            archive->file.reset(new MemoryMappedFile(path));
+            archive->size = archive->file->size();
+            archive->modificationTime = archive->file->modificationTime();
+        }
+        else
+        {
+            statFile(path, archive->size, archive->modificationTime);
+            archive->stream.reset(new std::ifstream(path, std::ios::binary));
+            if (!*archive->stream)
+            {
+                throw HpiException(("Unable to open archive " + path).c_str());
+            }
+        }
+
+        auto bind = [&archive](const HpiArchive::Directory& root, unsigned char decryptionKey)
+        {
+            return archive->file
+                ? std::make_unique<HpiArchive>(archive->file->data(), archive->file->size(), root, decryptionKey)
+                : std::make_unique<HpiArchive>(archive->stream.get(), root, decryptionKey);
+        };
+
+        if (slot.indexed)
+        {
+            archive->hpi = bind(slot.root, slot.decryptionKey);
+            return archive;
+        }
+
+        HpiArchive::Directory root;
+        unsigned char decryptionKey;
+        if (cache != nullptr && cache->find(path, archive->size, archive->modificationTime, root, decryptionKey))
+        {
+            archive->hpi = bind(root, decryptionKey);
+            return archive;
+        }
+
+        archive->hpi = archive->file
+            ? std::make_unique<HpiArchive>(archive->file->data(), archive->file->size())
+            : std::make_unique<HpiArchive>(archive->stream.get());
+        if (cache != nullptr)
+        {
+            cache->insert(path, archive->size, archive->modificationTime, archive->hpi->root(), archive->hpi->key());
+        }
+        return archive;
+    }
+
+    std::shared_ptr<const HpiArchive> HpiArchiveRepository::get(const std::string& path)
+    {
+        Slot* slot;
+        HpiIndexCache* cache;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<Slot>& p = slots[path];
+            if (!p)
+            {
+                p.reset(new Slot);
+            }
+            slot = p.get();
+            cache = indexCache;
+            if (slot->archive)
+            {
+                return touch(*slot);
+            }
+        }
+
+        std::lock_guard<std::mutex> openLock(slot->openMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (slot->archive)
+            {
+                // another thread opened it while we waited
+                return touch(*slot);
+            }
+        }
+
+        std::uint64_t size = slot->size;
+        if (!slot->indexed)
+        {
+            std::int64_t modificationTime;
+            statFile(path, size, modificationTime);
+        }
+
+        // room is made, and reserved, before mapping, so that the new mapping never pushes the total over
+        bool map;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            map = size <= maxMappedBytes;
+            if (map)
+            {
+                // streamed archives hold no address space, so only mapped ones make room
+                for (auto it = lru.end(); it != lru.begin() && mappedBytes + size > maxMappedBytes;)
+                {
+                    --it;
+                    if ((*it)->archive->file)
+                    {
+                        it = evict(it);
+                    }
+                }
+                mappedBytes += size;
+            }
+        }
+
+        // mapping and parsing happen outside the repository lock, so other archives aren't held up
+        std::shared_ptr<OpenArchive> archive;
+        try
+        {
+            try
+            {
+                archive = open(path, *slot, cache, map);
+            }
+            catch (const MemoryMappedFileException&)
+            {
+                if (!map)
+                {
+                    throw;
+                }
+                archive = open(path, *slot, cache, false);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            mappedBytes -= map ? size : 0u;
+            throw;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        mappedBytes -= map ? size : 0u;
+        mappedBytes += archive->file ? archive->file->size() : 0u;
+        if (!slot->indexed)
+        {
+            slot->root = archive->hpi->root();
+            slot->decryptionKey = archive->hpi->key();
+            slot->size = archive->size;
+            slot->modificationTime = archive->modificationTime;
+            slot->indexed = true;
+        }
+        slot->archive = archive;
+        lru.push_front(slot);
+        slot->lruPosition = lru.begin();
+
+        while (lru.size() > maxOpenArchives && lru.size() > 1)
+        {
+            evict(std::prev(lru.end()));
+        }
+
+        return std::shared_ptr<const HpiArchive>(archive, archive->hpi.get());
+    }
+
+    void HpiArchiveRepository::extract(const std::string& path, const HpiArchive::File& file, char* buffer)
+    {
+        get(path)->extract(file, buffer);
+    }
+
+    void HpiArchiveRepository::extract(const std::string& path, const HpiArchive::File& file, char* buffer, ThreadPool& pool)
+    {
+        get(path)->extract(file, buffer, pool);
+    }
+
+    void HpiArchiveRepository::visit(const std::string& path, const HpiArchive::File& file, const std::function<void(const char*, std::size_t)>& visitor)
+    {
+        get(path)->visit(file, visitor);
+    }
+
+    HpiArchiveRepository::Identity HpiArchiveRepository::identity(const std::string& path)
+    {
+        get(path);
+        std::lock_guard<std::mutex> lock(mutex);
+        const Slot& slot = *slots.at(path);
+        return Identity{ slot.size, slot.modificationTime };
+    }
+
+    std::size_t HpiArchiveRepository::openArchiveCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lru.size();
+    }
+}
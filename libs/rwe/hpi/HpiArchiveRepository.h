@@ -0,0 +1,114 @@
+#pragma once
+
+#include "HpiArchive.h"
+#include "HpiIndexCache.h"
+#include "rwe/MemoryMappedFile.h"
+
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace rwe
+{
+    /**
+     * Thread-safe, shared access to HPI archives by path.
+     *
+     * Archives are memory mapped rather than streamed, so there is no shared read position
+     * and any number of threads may extract from the same archive at once.
+     * At most maxOpenArchives stay open, and at most maxMappedBytes of them mapped. Beyond either,
+     * the least recently used archives are unmapped before another is mapped, and mapped again on their next use.
+     * An archive's directory is parsed only once and kept, so reopening costs a map call, not a header decrypt.
+     * With an index cache attached, directories parsed by earlier runs are reused too.
+     *
+     * An archive bigger than maxMappedBytes, or one that can't be mapped, e.g. for lack of address space
+     * in a 32 bit process, is read through a file stream instead. Extraction from it is then serialised.
+     */
+    class HpiArchiveRepository
+    {
+    private:
+        struct OpenArchive
+        {
+            std::unique_ptr<MemoryMappedFile> file;     // null if the archive is streamed instead
+            std::unique_ptr<std::ifstream> stream;
+            std::unique_ptr<HpiArchive> hpi;
+            std::uint64_t size = 0;
+            std::int64_t modificationTime = 0;
+        };
+
+        struct Slot
+        {
+            std::mutex openMutex;   // one thread opens, the rest wait for it
+            std::shared_ptr<OpenArchive> archive;
+            std::list<Slot*>::iterator lruPosition;
+
+            bool indexed = false;
+            HpiArchive::Directory root;
+            unsigned char decryptionKey = 0;
+            std::uint64_t size = 0;
+            std::int64_t modificationTime = 0;
+        };
+
+        std::mutex mutex;
+        std::map<std::string, std::unique_ptr<Slot>> slots;
+        std::list<Slot*> lru;   // open archives, most recently used first
+        std::size_t maxOpenArchives;
+        std::uint64_t maxMappedBytes;
+        std::uint64_t mappedBytes;  // of the archives in lru, and of those being mapped
+        HpiIndexCache* indexCache;
+
+    public:
+        /** Leaves most of a 32 bit process's 2GB of address space to everything else. */
+        static constexpr std::uint64_t DefaultMaxMappedBytes = sizeof(void*) > 4u ? std::uint64_t(1) << 40 : std::uint64_t(512) << 20;
+
+        /** What the archive file looked like when it was first opened. */
+        struct Identity
+        {
+            std::uint64_t size;
+            std::int64_t modificationTime;
+        };
+
+        explicit HpiArchiveRepository(std::size_t maxOpenArchives, std::uint64_t maxMappedBytes = DefaultMaxMappedBytes);
+
+        void setMaxOpenArchives(std::size_t maxOpenArchives);
+
+        void setMaxMappedBytes(std::uint64_t maxMappedBytes);
+
+        /**
+         * Consults indexCache before parsing an archive's directory, and records newly parsed ones in it.
+         * The cache must outlive the repository, or be detached by passing nullptr.
+         */
+        void setIndexCache(HpiIndexCache* indexCache);
+
+        /**
+         * Returns the archive at path, opening it if needed.
+         * The archive stays mapped for as long as the returned pointer is held,
+         * even if it falls out of the LRU set meanwhile, when it no longer counts towards maxMappedBytes.
+         * Throws if the archive can't be opened or parsed.
+         */
+        std::shared_ptr<const HpiArchive> get(const std::string& path);
+
+        /** Extracts file, found in the directory of the archive at path, into buffer. */
+        void extract(const std::string& path, const HpiArchive::File& file, char* buffer);
+
+        /** As above, decompressing the file's chunks concurrently on pool. */
+        void extract(const std::string& path, const HpiArchive::File& file, char* buffer, ThreadPool& pool);
+
+        /** Passes file to visitor a chunk at a time, see HpiArchive::visit(). */
+        void visit(const std::string& path, const HpiArchive::File& file, const std::function<void(const char*, std::size_t)>& visitor);
+
+        /** The size and modification time of the archive at path, opening it if needed. */
+        Identity identity(const std::string& path);
+
+        /** The number of archives currently held in the LRU set. */
+        std::size_t openArchiveCount();
+
+    private:
+        std::shared_ptr<const HpiArchive> touch(Slot& slot);
+        std::shared_ptr<OpenArchive> open(const std::string& path, const Slot& slot, HpiIndexCache* cache, bool map);
+        std::list<Slot*>::iterator evict(std::list<Slot*>::iterator position);
+    };
+}
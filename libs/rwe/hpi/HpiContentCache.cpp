@@ -0,0 +1,528 @@
+#include "HpiContentCache.h"
+#include "hpi_cache_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace rwe
+{
+    static const std::uint32_t ManifestMagicNumber = 0x43495048; // "HPIC"
+    static const std::uint32_t DataFileMagicNumber = 0x44495048; // "HPID"
+    static const std::uint32_t ContentCacheVersion = 1;
+
+    // what a record costs on top of its data, counted towards maxBytes so a cache of CRCs is bounded too
+    static const std::uint64_t RecordOverhead = 64u;
+
+    // trimming goes a little below the limit, so the next few inserts don't each trigger another pass
+    static const std::uint64_t EvictionSlackPercent = 10u;
+
+    // when a half written file must have been left by a process that died
+    static const std::chrono::hours StaleTemporaryFileAge(1);
+
+    static std::uint64_t recordCost(const std::string& archivePath, std::uint64_t dataSize)
+    {
+        return RecordOverhead + archivePath.size() + dataSize;
+    }
+
+    static unsigned long processId()
+    {
+#ifdef _WIN32
+        return static_cast<unsigned long>(_getpid());
+#else
+        return static_cast<unsigned long>(getpid());
+#endif
+    }
+
+    // a name no other writer, in this process or another, is using at the same time
+    static std::string temporaryFileName(const std::string& fileName)
+    {
+        static std::atomic<unsigned long> counter(0u);
+        return fileName + "." + std::to_string(processId()) + "." + std::to_string(++counter) + ".tmp";
+    }
+
+    void writeContentCacheKey(std::ostream& os, const HpiContentCache::Key& key)
+    {
+        writeCacheString(os, key.archivePath);
+        writeCacheRaw(os, key.archiveSize);
+        writeCacheRaw(os, key.archiveModificationTime);
+        writeCacheRaw(os, key.offset);
+        writeCacheRaw(os, key.size);
+        writeCacheRaw(os, key.compressionScheme);
+    }
+
+    HpiContentCache::Key readContentCacheKey(std::istream& is)
+    {
+        std::string archivePath = readCacheString(is);
+        std::uint64_t archiveSize = readCacheRaw<std::uint64_t>(is);
+        std::int64_t archiveModificationTime = readCacheRaw<std::int64_t>(is);
+        HpiArchive::File file;
+        file.offset = readCacheRaw<std::uint64_t>(is);
+        file.size = readCacheRaw<std::uint64_t>(is);
+        file.compressionScheme = static_cast<HpiArchive::File::CompressionScheme>(readCacheRaw<std::uint8_t>(is));
+        return HpiContentCache::Key(archivePath, archiveSize, archiveModificationTime, file);
+    }
+
+    HpiContentCache::Key::Key(const std::string& archivePath, std::uint64_t archiveSize, std::int64_t archiveModificationTime, const HpiArchive::File& file) :
+        archivePath(archivePath),
+        archiveSize(archiveSize),
+        archiveModificationTime(archiveModificationTime),
+        offset(file.offset),
+        size(file.size),
+        compressionScheme(static_cast<std::uint8_t>(file.compressionScheme))
+    {
+    }
+
+    bool HpiContentCache::Key::operator<(const Key& other) const
+    {
+        return std::tie(archivePath, archiveSize, archiveModificationTime, offset, size, compressionScheme) <
+            std::tie(other.archivePath, other.archiveSize, other.archiveModificationTime, other.offset, other.size, other.compressionScheme);
+    }
+
+    bool HpiContentCache::Key::operator==(const Key& other) const
+    {
+        return std::tie(archivePath, archiveSize, archiveModificationTime, offset, size, compressionScheme) ==
+            std::tie(other.archivePath, other.archiveSize, other.archiveModificationTime, other.offset, other.size, other.compressionScheme);
+    }
+
+    HpiContentCache::HpiContentCache(const std::string& directory, std::uint64_t maxBytes) :
+        directory(directory),
+        maxBytes(maxBytes),
+        useCounter(0u),
+        totalBytes(0u),
+        dirty(false)
+    {
+        CacheFileLock lock(directory + "/manifest.lock");
+        try
+        {
+            readManifest(records, useCounter);
+        }
+        catch (const std::exception&)
+        {
+            // start afresh, but from whatever data files are still there
+            records.clear();
+            useCounter = 0u;
+        }
+
+        for (const auto& p : records)
+        {
+            totalBytes += recordCost(p.first.archivePath, p.second.dataSize);
+        }
+
+        // without the lock, another process may be halfway through replacing the manifest, so leave the files be
+        if (lock)
+        {
+            adoptDataFiles();
+            evict();
+        }
+    }
+
+    std::string HpiContentCache::dataFileName(const Key& key) const
+    {
+        // FNV-1a over the identity. A collision only costs a miss, since the file repeats the key
+        std::uint64_t hash = 0xcbf29ce484222325ull;
+        auto mix = [&hash](const void* p, std::size_t size)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                hash = (hash ^ static_cast<const unsigned char*>(p)[i]) * 0x100000001b3ull;
+            }
+        };
+        mix(key.archivePath.data(), key.archivePath.size());
+        mix(&key.archiveSize, sizeof(key.archiveSize));
+        mix(&key.archiveModificationTime, sizeof(key.archiveModificationTime));
+        mix(&key.offset, sizeof(key.offset));
+        mix(&key.size, sizeof(key.size));
+        mix(&key.compressionScheme, sizeof(key.compressionScheme));
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+        return directory + "/" + name;
+    }
+
+    void HpiContentCache::touch(Record& record)
+    {
+        record.lastUse = ++useCounter;
+        dirty = true;
+    }
+
+    bool HpiContentCache::findCrc(const Key& key, std::uint32_t& crc)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = records.find(key);
+        if (it == records.end() || !it->second.hasCrc)
+        {
+            return false;
+        }
+
+        touch(it->second);
+        crc = it->second.crc;
+        return true;
+    }
+
+    void HpiContentCache::insertCrc(const Key& key, std::uint32_t crc)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = records.find(key);
+        if (it == records.end())
+        {
+            it = records.emplace(key, Record()).first;
+            totalBytes += recordCost(key.archivePath, 0u);
+        }
+
+        it->second.hasCrc = true;
+        it->second.crc = crc;
+        touch(it->second);
+        evict();
+    }
+
+    bool HpiContentCache::findData(const Key& key, std::string& data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = records.find(key);
+            if (it == records.end() || !it->second.hasData)
+            {
+                return false;
+            }
+            touch(it->second);
+        }
+
+        try
+        {
+            std::ifstream ifs(dataFileName(key), std::ios::binary);
+            if (ifs && readCacheRaw<std::uint32_t>(ifs) == DataFileMagicNumber && readContentCacheKey(ifs) == key)
+            {
+                std::uint64_t size = readCacheRaw<std::uint64_t>(ifs);
+                if (size == key.size)
+                {
+                    data.resize(size);
+                    if (ifs.read(&data[0], size))
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+        catch (const std::exception&)
+        {
+        }
+
+        // the file went missing or was replaced, e.g. by another process evicting it
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = records.find(key);
+        if (it != records.end() && it->second.hasData)
+        {
+            it->second.hasData = false;
+            totalBytes -= it->second.dataSize;
+            it->second.dataSize = 0u;
+            lostData.insert(key);
+            dirty = true;
+        }
+        return false;
+    }
+
+    void HpiContentCache::insertData(const Key& key, const char* data, std::size_t size)
+    {
+        if (recordCost(key.archivePath, size) > maxBytes)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = records.find(key);
+            if (it != records.end() && it->second.hasData)
+            {
+                return;
+            }
+        }
+
+        // written aside and renamed into place, so a .bin file is only ever seen whole.
+        // The same key always has the same bytes, so a racing writer of the same file does no harm
+        std::string fileName = dataFileName(key);
+        std::string temporary = temporaryFileName(fileName);
+        {
+            std::ofstream ofs(temporary, std::ios::binary);
+            writeCacheRaw(ofs, DataFileMagicNumber);
+            writeContentCacheKey(ofs, key);
+            writeCacheRaw<std::uint64_t>(ofs, size);
+            ofs.write(data, size);
+            if (!ofs.flush())
+            {
+                ofs.close();
+                std::remove(temporary.c_str());
+                return;
+            }
+        }
+        if (std::rename(temporary.c_str(), fileName.c_str()) != 0)
+        {
+            // on Windows, rename() won't replace a file. Either way it's there already or can't be put there
+            std::remove(temporary.c_str());
+            std::ifstream ifs(fileName, std::ios::binary);
+            if (!ifs)
+            {
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = records.find(key);
+        if (it == records.end())
+        {
+            it = records.emplace(key, Record()).first;
+            totalBytes += recordCost(key.archivePath, 0u);
+        }
+
+        if (!it->second.hasData)
+        {
+            it->second.hasData = true;
+            it->second.dataSize = size;
+            totalBytes += size;
+        }
+        touch(it->second);
+        evict();
+    }
+
+    void HpiContentCache::evict()
+    {
+        if (totalBytes <= maxBytes)
+        {
+            return;
+        }
+
+        std::vector<std::map<Key, Record>::iterator> byAge;
+        byAge.reserve(records.size());
+        for (auto it = records.begin(); it != records.end(); ++it)
+        {
+            byAge.push_back(it);
+        }
+        std::sort(byAge.begin(), byAge.end(), [](const auto& a, const auto& b) { return a->second.lastUse < b->second.lastUse; });
+
+        std::uint64_t target = maxBytes - maxBytes / 100u * EvictionSlackPercent;
+        for (auto it : byAge)
+        {
+            if (totalBytes <= target)
+            {
+                break;
+            }
+
+            if (it->second.hasData)
+            {
+                std::remove(dataFileName(it->first).c_str());
+            }
+            totalBytes -= recordCost(it->first.archivePath, it->second.dataSize);
+            evicted.insert(it->first);
+            records.erase(it);
+        }
+        dirty = true;
+    }
+
+    void HpiContentCache::readManifest(std::map<Key, Record>& manifestRecords, std::uint64_t& manifestUseCounter) const
+    {
+        std::ifstream ifs(directory + "/manifest", std::ios::binary);
+        if (!ifs)
+        {
+            return;
+        }
+
+        if (readCacheRaw<std::uint32_t>(ifs) != ManifestMagicNumber || readCacheRaw<std::uint32_t>(ifs) != ContentCacheVersion)
+        {
+            throw HpiException("Incompatible HPI content cache");
+        }
+
+        manifestUseCounter = readCacheRaw<std::uint64_t>(ifs);
+        std::uint32_t count = readCacheRaw<std::uint32_t>(ifs);
+        for (std::uint32_t n = 0u; n < count; ++n)
+        {
+            Key key = readContentCacheKey(ifs);
+            Record record;
+            record.hasCrc = readCacheRaw<std::uint8_t>(ifs) != 0u;
+            record.crc = readCacheRaw<std::uint32_t>(ifs);
+            record.hasData = readCacheRaw<std::uint8_t>(ifs) != 0u;
+            record.dataSize = record.hasData ? key.size : 0u;
+            record.lastUse = readCacheRaw<std::uint64_t>(ifs);
+            manifestRecords.emplace(std::move(key), record);
+        }
+    }
+
+    void HpiContentCache::adoptDataFiles()
+    {
+        std::set<std::string> listed;
+        for (const auto& p : records)
+        {
+            if (p.second.hasData)
+            {
+                listed.insert(std::filesystem::path(dataFileName(p.first)).filename().string());
+            }
+        }
+
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+        {
+            const std::filesystem::path& path = it->path();
+            if (path.extension() == ".tmp")
+            {
+                if (isCacheFileOlderThan(path.string(), StaleTemporaryFileAge))
+                {
+                    std::remove(path.string().c_str());
+                }
+                continue;
+            }
+            if (path.extension() != ".bin" || listed.count(path.filename().string()) != 0u)
+            {
+                continue;
+            }
+
+            // written by a run whose manifest was lost. Take it on as least recently used if it's sound
+            bool adopted = false;
+            try
+            {
+                std::ifstream ifs(path, std::ios::binary);
+                if (ifs && readCacheRaw<std::uint32_t>(ifs) == DataFileMagicNumber)
+                {
+                    Key key = readContentCacheKey(ifs);
+                    std::uint64_t size = readCacheRaw<std::uint64_t>(ifs);
+                    std::uint64_t expectedFileSize = static_cast<std::uint64_t>(ifs.tellg()) + size;
+                    if (size == key.size && std::filesystem::file_size(path) == expectedFileSize && dataFileName(key) == directory + "/" + path.filename().string())
+                    {
+                        auto recordIt = records.find(key);
+                        if (recordIt == records.end())
+                        {
+                            recordIt = records.emplace(key, Record()).first;
+                            totalBytes += recordCost(key.archivePath, 0u);
+                        }
+                        recordIt->second.hasData = true;
+                        recordIt->second.dataSize = size;
+                        totalBytes += size;
+                        adopted = true;
+                        dirty = true;
+                    }
+                }
+            }
+            catch (const std::exception&)
+            {
+            }
+
+            if (!adopted)
+            {
+                std::remove(path.string().c_str());
+            }
+        }
+    }
+
+    void HpiContentCache::save()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!dirty)
+        {
+            return;
+        }
+
+        CacheFileLock manifestLock(directory + "/manifest.lock");
+        if (!manifestLock)
+        {
+            return;
+        }
+
+        // fold in whatever other processes saved since this one loaded, less what this one has dropped since
+        std::map<Key, Record> saved;
+        std::uint64_t savedUseCounter = 0u;
+        try
+        {
+            readManifest(saved, savedUseCounter);
+        }
+        catch (const std::exception&)
+        {
+            saved.clear();
+        }
+
+        for (const auto& p : saved)
+        {
+            if (evicted.count(p.first) != 0u)
+            {
+                continue;
+            }
+
+            Record theirs = p.second;
+            if (lostData.count(p.first) != 0u)
+            {
+                theirs.hasData = false;
+                theirs.dataSize = 0u;
+            }
+
+            auto it = records.find(p.first);
+            if (it == records.end())
+            {
+                records.emplace(p.first, theirs);
+                totalBytes += recordCost(p.first.archivePath, theirs.dataSize);
+                continue;
+            }
+
+            Record& ours = it->second;
+            if (!ours.hasCrc && theirs.hasCrc)
+            {
+                ours.hasCrc = true;
+                ours.crc = theirs.crc;
+            }
+            if (!ours.hasData && theirs.hasData)
+            {
+                ours.hasData = true;
+                ours.dataSize = theirs.dataSize;
+                totalBytes += theirs.dataSize;
+            }
+            ours.lastUse = std::max(ours.lastUse, theirs.lastUse);
+        }
+        useCounter = std::max(useCounter, savedUseCounter);
+        evict();
+
+        // write aside and swap in, so a reader never sees half a manifest
+        std::string manifest = directory + "/manifest";
+        std::string temporary = temporaryFileName(manifest);
+        {
+            std::ofstream ofs(temporary, std::ios::binary);
+            writeCacheRaw(ofs, ManifestMagicNumber);
+            writeCacheRaw(ofs, ContentCacheVersion);
+            writeCacheRaw(ofs, useCounter);
+            writeCacheRaw<std::uint32_t>(ofs, static_cast<std::uint32_t>(records.size()));
+            for (const auto& p : records)
+            {
+                writeContentCacheKey(ofs, p.first);
+                writeCacheRaw<std::uint8_t>(ofs, p.second.hasCrc ? 1u : 0u);
+                writeCacheRaw(ofs, p.second.crc);
+                writeCacheRaw<std::uint8_t>(ofs, p.second.hasData ? 1u : 0u);
+                writeCacheRaw(ofs, p.second.lastUse);
+            }
+            if (!ofs.flush())
+            {
+                ofs.close();
+                std::remove(temporary.c_str());
+                return;
+            }
+        }
+
+        // rename() won't replace an existing file on Windows. Readers hold the lock, so none sees the gap
+        std::remove(manifest.c_str());
+        if (std::rename(temporary.c_str(), manifest.c_str()) == 0)
+        {
+            dirty = false;
+            evicted.clear();
+            lostData.clear();
+        }
+        else
+        {
+            std::remove(temporary.c_str());
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "HpiArchive.h"
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+
+namespace rwe
+{
+    /**
+     * An on-disk cache of extracted archive entries, or of just their CRC32s,
+     * so repeat runs can skip decompression entirely.
+     *
+     * An entry is identified by its archive's path, size and modification time,
+     * and by its position, size and compression scheme within that archive.
+     * Cached bytes live in one file per entry, named after a hash of that identity,
+     * with the identity repeated inside the file so a stale or foreign file is never mistaken for a hit.
+     * A manifest records what is cached and when it was last used.
+     * Once the cache grows past maxBytes, the least recently used entries are dropped.
+     *
+     * All methods are thread-safe. Several processes may share a directory: the manifest is only read and
+     * replaced under a lock file, save() merges with what other processes saved in the meantime,
+     * and data files that no manifest lists, e.g. after a crash, are taken back in on opening.
+     */
+    class HpiContentCache
+    {
+    public:
+        struct Key
+        {
+            std::string archivePath;
+            std::uint64_t archiveSize;
+            std::int64_t archiveModificationTime;
+            std::uint64_t offset;
+            std::uint64_t size;
+            std::uint8_t compressionScheme;
+
+            Key(const std::string& archivePath, std::uint64_t archiveSize, std::int64_t archiveModificationTime, const HpiArchive::File& file);
+
+            bool operator<(const Key& other) const;
+            bool operator==(const Key& other) const;
+        };
+
+    private:
+        struct Record
+        {
+            bool hasCrc = false;
+            std::uint32_t crc = 0u;
+            bool hasData = false;
+            std::uint64_t dataSize = 0u;
+            std::uint64_t lastUse = 0u;
+        };
+
+        std::string directory;
+        std::uint64_t maxBytes;
+
+        mutable std::mutex mutex;
+        std::map<Key, Record> records;
+        std::uint64_t useCounter;
+        std::uint64_t totalBytes;
+        bool dirty;
+
+        // dropped since the last save(), so that merging with the manifest on disk doesn't bring them back
+        std::set<Key> evicted;
+        std::set<Key> lostData;
+
+    public:
+        /**
+         * Opens the cache kept in directory, which must exist.
+         * A missing or unreadable manifest starts the cache from the data files in the directory.
+         */
+        HpiContentCache(const std::string& directory, std::uint64_t maxBytes);
+
+        /** Looks up the CRC32 of the entry's decompressed bytes. */
+        bool findCrc(const Key& key, std::uint32_t& crc);
+
+        void insertCrc(const Key& key, std::uint32_t crc);
+
+        /** Looks up the entry's decompressed bytes. */
+        bool findData(const Key& key, std::string& data);
+
+        void insertData(const Key& key, const char* data, std::size_t size);
+
+        /**
+         * Writes the manifest back to the cache directory, if anything changed, merged with
+         * whatever other processes saved since. Gives up, leaving the changes to a later save(),
+         * if another process holds the manifest too long.
+         */
+        void save();
+
+    private:
+        std::string dataFileName(const Key& key) const;
+        void touch(Record& record);
+        void evict();
+        void readManifest(std::map<Key, Record>& manifestRecords, std::uint64_t& manifestUseCounter) const;
+        void adoptDataFiles();
+    };
+
+    /** Binary helpers for Key, for other caches of data derived from archive entries. */
+    void writeContentCacheKey(std::ostream& os, const HpiContentCache::Key& key);
+    HpiContentCache::Key readContentCacheKey(std::istream& is);
+}
@@ -0,0 +1,199 @@
+#include "HpiIndexCache.h"
+#include "hpi_cache_io.h"
+#include "hpi_util.h"
+#include "rwe/MemoryMappedFile.h"
+
+namespace rwe
+{
+    static const std::uint32_t IndexCacheMagicNumber = 0x58495048; // "HPIX"
+    static const std::uint32_t IndexCacheVersion = 1;
+    static const unsigned int MaxDirectoryDepth = 256;
+
+    enum class IndexRecordType : unsigned char
+    {
+        File = 0,
+        Directory
+    };
+
+    static void writeDirectory(std::ostream& os, const HpiArchive::Directory& directory)
+    {
+        writeCacheRaw<std::uint32_t>(os, directory.entries.size());
+        for (const HpiArchive::DirectoryEntry& entry : directory.entries)
+        {
+            writeCacheString(os, entry.name);
+            if (entry.file)
+            {
+                writeCacheRaw(os, IndexRecordType::File);
+                writeCacheRaw<unsigned char>(os, static_cast<unsigned char>(entry.file->compressionScheme));
+                writeCacheRaw<std::uint32_t>(os, entry.file->offset);
+                writeCacheRaw<std::uint32_t>(os, entry.file->size);
+            }
+            else
+            {
+                writeCacheRaw(os, IndexRecordType::Directory);
+                writeDirectory(os, *entry.directory);
+            }
+        }
+    }
+
+    static std::shared_ptr<HpiArchive::Directory> readDirectory(std::istream& is, unsigned int depth)
+    {
+        if (depth > MaxDirectoryDepth)
+        {
+            throw HpiException("Corrupt cache file");
+        }
+
+        auto directory = std::make_shared<HpiArchive::Directory>();
+        std::uint32_t count = readCacheRaw<std::uint32_t>(is);
+        for (std::uint32_t n = 0u; n < count; ++n)
+        {
+            std::string name = readCacheString(is);
+            switch (readCacheRaw<IndexRecordType>(is))
+            {
+                case IndexRecordType::File:
+                {
+                    unsigned char scheme = readCacheRaw<unsigned char>(is);
+                    if (scheme > static_cast<unsigned char>(HpiArchive::File::CompressionScheme::ZLib))
+                    {
+                        throw HpiException("Corrupt cache file");
+                    }
+                    std::uint32_t offset = readCacheRaw<std::uint32_t>(is);
+                    std::uint32_t size = readCacheRaw<std::uint32_t>(is);
+                    directory->entries.emplace_back(name, std::shared_ptr<HpiArchive::File>(new HpiArchive::File{
+                        static_cast<HpiArchive::File::CompressionScheme>(scheme), offset, size
+                    }));
+                    break;
+                }
+                case IndexRecordType::Directory:
+                    directory->entries.emplace_back(name, readDirectory(is, depth + 1));
+                    break;
+                default:
+                    throw HpiException("Corrupt cache file");
+            }
+        }
+        return directory;
+    }
+
+    HpiIndexCache::HpiIndexCache() : dirty(false)
+    {
+    }
+
+    bool HpiIndexCache::find(
+        const std::string& path, std::uint64_t size, std::int64_t modificationTime,
+        HpiArchive::Directory& root, unsigned char& decryptionKey) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(path);
+        if (it == entries.end() || it->second.size != size || it->second.modificationTime != modificationTime)
+        {
+            return false;
+        }
+
+        root = it->second.root;
+        decryptionKey = it->second.decryptionKey;
+        return true;
+    }
+
+    void HpiIndexCache::insert(
+        const std::string& path, std::uint64_t size, std::int64_t modificationTime,
+        const HpiArchive::Directory& root, unsigned char decryptionKey)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[path] = Entry{ size, modificationTime, decryptionKey, root };
+        dirty = true;
+    }
+
+    bool HpiIndexCache::isDirty() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dirty;
+    }
+
+    void HpiIndexCache::dropStale()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            std::uint64_t size;
+            std::int64_t modificationTime;
+            bool stale;
+            try
+            {
+                statFile(it->first, size, modificationTime);
+                stale = size != it->second.size || modificationTime != it->second.modificationTime;
+            }
+            catch (const MemoryMappedFileException&)
+            {
+                stale = true;
+            }
+
+            if (stale)
+            {
+                it = entries.erase(it);
+                dirty = true;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    void HpiIndexCache::merge(const HpiIndexCache& other)
+    {
+        if (&other == this)
+        {
+            return;
+        }
+
+        std::scoped_lock lock(mutex, other.mutex);
+        for (const auto& p : other.entries)
+        {
+            if (entries.emplace(p.first, p.second).second)
+            {
+                dirty = true;
+            }
+        }
+    }
+
+    void HpiIndexCache::serialise(std::ostream& os) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeCacheRaw(os, IndexCacheMagicNumber);
+        writeCacheRaw(os, IndexCacheVersion);
+        writeCacheRaw<std::uint32_t>(os, entries.size());
+        for (const auto& p : entries)
+        {
+            writeCacheString(os, p.first);
+            writeCacheRaw(os, p.second.size);
+            writeCacheRaw(os, p.second.modificationTime);
+            writeCacheRaw(os, p.second.decryptionKey);
+            writeDirectory(os, p.second.root);
+        }
+    }
+
+    void HpiIndexCache::deserialise(std::istream& is)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        dirty = false;
+
+        if (readCacheRaw<std::uint32_t>(is) != IndexCacheMagicNumber || readCacheRaw<std::uint32_t>(is) != IndexCacheVersion)
+        {
+            throw HpiException("Incompatible HPI index cache");
+        }
+
+        std::map<std::string, Entry> loaded;
+        std::uint32_t count = readCacheRaw<std::uint32_t>(is);
+        for (std::uint32_t n = 0u; n < count; ++n)
+        {
+            std::string path = readCacheString(is);
+            Entry& entry = loaded[path];
+            entry.size = readCacheRaw<std::uint64_t>(is);
+            entry.modificationTime = readCacheRaw<std::int64_t>(is);
+            entry.decryptionKey = readCacheRaw<unsigned char>(is);
+            entry.root = std::move(*readDirectory(is, 0u));
+        }
+        entries.swap(loaded);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "HpiArchive.h"
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace rwe
+{
+    /**
+     * Remembers the parsed directory of each archive between runs,
+     * so an unchanged archive can be opened without decrypting its header.
+     *
+     * Entries are keyed by archive path and are only valid while the archive's size
+     * and modification time still match those recorded.
+     * The cache is serialised as a flat list of entries, each directory tree written depth first.
+     * Entries for archives that have since gone or changed can be dropped before saving,
+     * and several processes' caches merged, so one shared cache file serves every install and run that uses it.
+     * All methods are thread-safe.
+     */
+    class HpiIndexCache
+    {
+    private:
+        struct Entry
+        {
+            std::uint64_t size;
+            std::int64_t modificationTime;
+            unsigned char decryptionKey;
+            HpiArchive::Directory root;
+        };
+
+        mutable std::mutex mutex;
+        std::map<std::string, Entry> entries;
+        bool dirty;
+
+    public:
+        HpiIndexCache();
+
+        /**
+         * Looks up the archive at path. Returns false if it isn't cached,
+         * or if it was cached with a different size or modification time.
+         */
+        bool find(
+            const std::string& path, std::uint64_t size, std::int64_t modificationTime,
+            HpiArchive::Directory& root, unsigned char& decryptionKey) const;
+
+        void insert(
+            const std::string& path, std::uint64_t size, std::int64_t modificationTime,
+            const HpiArchive::Directory& root, unsigned char decryptionKey);
+
+        /** True if anything was inserted or dropped since the cache was created or last loaded. */
+        bool isDirty() const;
+
+        /** Drops the archives that no longer exist, or whose size or modification time have changed since they were cached. */
+        void dropStale();
+
+        /** Takes in other's entries for archives this cache has none for, e.g. those saved meanwhile by another process. */
+        void merge(const HpiIndexCache& other);
+
+        void serialise(std::ostream& os) const;
+
+        /**
+         * Replaces the cache's contents with those read from is.
+         * Throws HpiException if the data is truncated, corrupt or from an incompatible version,
+         * in which case the cache is left empty.
+         */
+        void deserialise(std::istream& is);
+    };
+}
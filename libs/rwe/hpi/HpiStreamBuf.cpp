@@ -0,0 +1,124 @@
+#include "HpiStreamBuf.h"
+
+#include <algorithm>
+
+namespace rwe
+{
+    // refills are aligned to chunks, so each one decompresses exactly one chunk
+    static const std::size_t BufferSize = 65536;
+
+    HpiStreamBuf::HpiStreamBuf(std::shared_ptr<const HpiArchive> archive, const HpiArchive::File& file) :
+        archive(std::move(archive)),
+        file(file),
+        buffer(BufferSize),
+        bufferStart(0)
+    {
+        emptyBufferAt(0);
+    }
+
+    std::size_t HpiStreamBuf::position() const
+    {
+        return bufferStart + (gptr() - eback());
+    }
+
+    void HpiStreamBuf::emptyBufferAt(std::size_t _position)
+    {
+        bufferStart = _position;
+        setg(buffer.data(), buffer.data(), buffer.data());
+    }
+
+    HpiStreamBuf::int_type HpiStreamBuf::underflow()
+    {
+        std::size_t pos = position();
+        if (pos >= file.size)
+        {
+            return traits_type::eof();
+        }
+
+        std::size_t start = pos - pos % BufferSize;
+        std::size_t size = std::min(BufferSize, file.size - start);
+        archive->extractRange(file, start, size, buffer.data());
+
+        bufferStart = start;
+        setg(buffer.data(), buffer.data() + (pos - start), buffer.data() + size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize HpiStreamBuf::xsgetn(char_type* s, std::streamsize n)
+    {
+        std::streamsize count = 0;
+
+        std::streamsize buffered = std::min<std::streamsize>(n, egptr() - gptr());
+        std::copy(gptr(), gptr() + buffered, s);
+        gbump(static_cast<int>(buffered));
+        count += buffered;
+
+        std::size_t pos = position();
+        std::size_t remaining = std::min(static_cast<std::size_t>(n - count), file.size - pos);
+        if (remaining >= BufferSize)
+        {
+            archive->extractRange(file, pos, remaining, s + count);
+            count += remaining;
+            emptyBufferAt(pos + remaining);
+        }
+
+        if (count < n)
+        {
+            count += std::streambuf::xsgetn(s + count, n - count);
+        }
+        return count;
+    }
+
+    std::streamsize HpiStreamBuf::showmanyc()
+    {
+        std::size_t pos = position();
+        return pos < file.size ? static_cast<std::streamsize>(file.size - pos) : -1;
+    }
+
+    HpiStreamBuf::pos_type HpiStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+    {
+        if ((which & std::ios_base::in) == 0)
+        {
+            return pos_type(off_type(-1));
+        }
+
+        off_type base;
+        switch (dir)
+        {
+            case std::ios_base::beg:
+                base = 0;
+                break;
+            case std::ios_base::cur:
+                base = static_cast<off_type>(position());
+                break;
+            case std::ios_base::end:
+                base = static_cast<off_type>(file.size);
+                break;
+            default:
+                return pos_type(off_type(-1));
+        }
+
+        off_type target = base + off;
+        if (target < 0 || target > static_cast<off_type>(file.size))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        // stay on the buffered chunk if the target is in it, otherwise refill lazily on the next read
+        auto newPosition = static_cast<std::size_t>(target);
+        if (newPosition >= bufferStart && newPosition <= bufferStart + (egptr() - eback()))
+        {
+            setg(eback(), eback() + (newPosition - bufferStart), egptr());
+        }
+        else
+        {
+            emptyBufferAt(newPosition);
+        }
+        return pos_type(target);
+    }
+
+    HpiStreamBuf::pos_type HpiStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+}
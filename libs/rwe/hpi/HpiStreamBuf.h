@@ -0,0 +1,43 @@
+#pragma once
+
+#include "HpiArchive.h"
+
+#include <memory>
+#include <streambuf>
+#include <vector>
+
+namespace rwe
+{
+    /**
+     * A seekable, read-only std::streambuf over one file inside an HPI archive.
+     * Bytes are extracted on demand a chunk at a time, so a reader that only visits
+     * a few parts of a large file (e.g. a TntArchive reading the minimap) never decompresses the rest.
+     * Large reads bypass the buffer and are extracted straight into the caller's memory.
+     *
+     * Intended for archives read from memory. Over a stream based archive every refill
+     * would decompress the whole file.
+     */
+    class HpiStreamBuf : public std::streambuf
+    {
+    private:
+        std::shared_ptr<const HpiArchive> archive;
+        HpiArchive::File file;
+        std::vector<char> buffer;
+        std::size_t bufferStart;    // position within the file of buffer[0]
+
+    public:
+        /** archive is held for as long as the buffer lives, keeping its bytes mapped. */
+        HpiStreamBuf(std::shared_ptr<const HpiArchive> archive, const HpiArchive::File& file);
+
+    protected:
+        int_type underflow() override;
+        std::streamsize xsgetn(char_type* s, std::streamsize n) override;
+        std::streamsize showmanyc() override;
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+    private:
+        std::size_t position() const;
+        void emptyBufferAt(std::size_t position);
+    };
+}
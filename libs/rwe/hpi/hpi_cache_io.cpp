@@ -0,0 +1,58 @@
+#include "hpi_cache_io.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+namespace rwe
+{
+    // how long to wait for another process to finish with a cache file, and when to assume one died holding it
+    static const std::chrono::seconds CacheFileLockTimeout(10);
+    static const std::chrono::seconds StaleCacheFileLockAge(60);
+
+    bool isCacheFileOlderThan(const std::string& path, std::chrono::seconds age)
+    {
+        std::error_code ec;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, ec);
+        return !ec && std::filesystem::file_time_type::clock::now() - modified > age;
+    }
+
+    CacheFileLock::CacheFileLock(const std::string& path) : path(path), locked(false)
+    {
+        auto deadline = std::chrono::steady_clock::now() + CacheFileLockTimeout;
+        while (true)
+        {
+            if (std::FILE* file = std::fopen(path.c_str(), "wx"))
+            {
+                std::fclose(file);
+                locked = true;
+                return;
+            }
+
+            if (isCacheFileOlderThan(path, StaleCacheFileLockAge))
+            {
+                std::remove(path.c_str());
+                continue;
+            }
+
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    CacheFileLock::~CacheFileLock()
+    {
+        if (locked)
+        {
+            std::remove(path.c_str());
+        }
+    }
+
+    CacheFileLock::operator bool() const
+    {
+        return locked;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "hpi_util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace rwe
+{
+    // binary helpers for the HPI cache files, written in host byte order
+
+    static const std::uint32_t MaxCacheStringLength = 4096;
+
+    template <typename T>
+    void writeCacheRaw(std::ostream& os, T value)
+    {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    inline void writeCacheString(std::ostream& os, const std::string& s)
+    {
+        writeCacheRaw<std::uint32_t>(os, static_cast<std::uint32_t>(s.size()));
+        os.write(s.data(), s.size());
+    }
+
+    template <typename T>
+    T readCacheRaw(std::istream& is)
+    {
+        T value;
+        if (!is.read(reinterpret_cast<char*>(&value), sizeof(value)))
+        {
+            throw HpiException("Truncated cache file");
+        }
+        return value;
+    }
+
+    inline std::string readCacheString(std::istream& is)
+    {
+        std::uint32_t length = readCacheRaw<std::uint32_t>(is);
+        if (length > MaxCacheStringLength)
+        {
+            throw HpiException("Corrupt cache file");
+        }
+
+        std::string s(length, '\0');
+        if (!is.read(&s[0], length))
+        {
+            throw HpiException("Truncated cache file");
+        }
+        return s;
+    }
+
+    /** True if the file at path exists and was last written more than age ago. */
+    bool isCacheFileOlderThan(const std::string& path, std::chrono::seconds age);
+
+    /**
+     * Serialises access to a cache file between processes, by exclusively creating a lock file at path.
+     * Gives up after 10 seconds, and a lock file older than a minute is taken to be left by a crash.
+     */
+    class CacheFileLock
+    {
+    private:
+        std::string path;
+        bool locked;
+
+    public:
+        explicit CacheFileLock(const std::string& path);
+        ~CacheFileLock();
+
+        CacheFileLock(const CacheFileLock&) = delete;
+        CacheFileLock& operator=(const CacheFileLock&) = delete;
+
+        /** False if the lock couldn't be had in time. */
+        explicit operator bool() const;
+    };
+}
@@ -0,0 +1,243 @@
+#include "hpi_simd.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RWE_HPI_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit SSE2/AVX2 instructions inside functions marked for them,
+// MSVC accepts the intrinsics anywhere.
+#if defined(__GNUC__)
+#define RWE_HPI_TARGET(x) __attribute__((target(x)))
+#else
+#define RWE_HPI_TARGET(x)
+#endif
+
+namespace rwe
+{
+    static void scalarDecrypt(unsigned char key, unsigned char seed, const char* in, char* out, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            auto pos = static_cast<unsigned char>(seed + i);
+            out[i] = static_cast<char>((pos ^ key) ^ static_cast<unsigned char>(in[i]));
+        }
+    }
+
+    /** Inner decryption of buffer[begin, size), the positions counting from the start of buffer. */
+    static void scalarDecryptInnerFrom(char* buffer, std::size_t begin, std::size_t size)
+    {
+        for (std::size_t i = begin; i < size; ++i)
+        {
+            auto pos = static_cast<unsigned char>(i);
+            buffer[i] = static_cast<char>((static_cast<unsigned char>(buffer[i]) - pos) ^ pos);
+        }
+    }
+
+    static void scalarDecryptInner(char* buffer, std::size_t size)
+    {
+        scalarDecryptInnerFrom(buffer, 0, size);
+    }
+
+    static std::uint32_t scalarChecksum(const char* buffer, std::size_t size)
+    {
+        std::uint32_t sum = 0;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            sum += static_cast<unsigned char>(buffer[i]);
+        }
+        return sum;
+    }
+
+    const HpiKernels& hpiScalarKernels()
+    {
+        static const HpiKernels kernels{ "scalar", scalarDecrypt, scalarDecryptInner, scalarChecksum };
+        return kernels;
+    }
+
+#ifdef RWE_HPI_X86
+    // The key stream repeats every 256 bytes, so a vector of positions just wraps
+    // as it advances 16 (or 32) bytes at a time. Any remainder is left to the scalar loop,
+    // which picks the position up where the vector loop stopped.
+
+    RWE_HPI_TARGET("sse2")
+    static void sse2Decrypt(unsigned char key, unsigned char seed, const char* in, char* out, std::size_t size)
+    {
+        const __m128i step = _mm_set1_epi8(16);
+        const __m128i keys = _mm_set1_epi8(static_cast<char>(key));
+        __m128i pos = _mm_add_epi8(
+            _mm_set1_epi8(static_cast<char>(seed)),
+            _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            v = _mm_xor_si128(v, _mm_xor_si128(pos, keys));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+            pos = _mm_add_epi8(pos, step);
+        }
+        scalarDecrypt(key, static_cast<unsigned char>(seed + i), in + i, out + i, size - i);
+    }
+
+    RWE_HPI_TARGET("sse2")
+    static void sse2DecryptInner(char* buffer, std::size_t size)
+    {
+        const __m128i step = _mm_set1_epi8(16);
+        __m128i pos = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i));
+            v = _mm_xor_si128(_mm_sub_epi8(v, pos), pos);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + i), v);
+            pos = _mm_add_epi8(pos, step);
+        }
+        scalarDecryptInnerFrom(buffer, i, size);
+    }
+
+    RWE_HPI_TARGET("sse2")
+    static std::uint32_t sse2Checksum(const char* buffer, std::size_t size)
+    {
+        // psadbw against zero sums each group of 8 bytes into a 64 bit lane
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sums = _mm_setzero_si128();
+
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(v, zero));
+        }
+
+        sums = _mm_add_epi64(sums, _mm_unpackhi_epi64(sums, sums));
+        auto sum = static_cast<std::uint32_t>(_mm_cvtsi128_si32(sums));
+        return sum + scalarChecksum(buffer + i, size - i);
+    }
+
+    RWE_HPI_TARGET("avx2")
+    static void avx2Decrypt(unsigned char key, unsigned char seed, const char* in, char* out, std::size_t size)
+    {
+        const __m256i step = _mm256_set1_epi8(32);
+        const __m256i keys = _mm256_set1_epi8(static_cast<char>(key));
+        __m256i pos = _mm256_add_epi8(
+            _mm256_set1_epi8(static_cast<char>(seed)),
+            _mm256_setr_epi8(
+                0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31));
+
+        std::size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            v = _mm256_xor_si256(v, _mm256_xor_si256(pos, keys));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+            pos = _mm256_add_epi8(pos, step);
+        }
+        scalarDecrypt(key, static_cast<unsigned char>(seed + i), in + i, out + i, size - i);
+    }
+
+    RWE_HPI_TARGET("avx2")
+    static void avx2DecryptInner(char* buffer, std::size_t size)
+    {
+        const __m256i step = _mm256_set1_epi8(32);
+        __m256i pos = _mm256_setr_epi8(
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+            16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+
+        std::size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i));
+            v = _mm256_xor_si256(_mm256_sub_epi8(v, pos), pos);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(buffer + i), v);
+            pos = _mm256_add_epi8(pos, step);
+        }
+        scalarDecryptInnerFrom(buffer, i, size);
+    }
+
+    RWE_HPI_TARGET("avx2")
+    static std::uint32_t avx2Checksum(const char* buffer, std::size_t size)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i sums = _mm256_setzero_si256();
+
+        std::size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i));
+            sums = _mm256_add_epi64(sums, _mm256_sad_epu8(v, zero));
+        }
+
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+        auto sum = static_cast<std::uint32_t>(_mm_cvtsi128_si32(half));
+        return sum + scalarChecksum(buffer + i, size - i);
+    }
+
+    static bool cpuHasSse2()
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        return true;
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+
+    static bool cpuHasAvx2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        // AVX2 also needs the OS to save the upper halves of the ymm registers
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+        {
+            return false;
+        }
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    static const HpiKernels& selectKernels()
+    {
+#ifdef RWE_HPI_X86
+        static const HpiKernels avx2{ "avx2", avx2Decrypt, avx2DecryptInner, avx2Checksum };
+        static const HpiKernels sse2{ "sse2", sse2Decrypt, sse2DecryptInner, sse2Checksum };
+        if (cpuHasAvx2())
+        {
+            return avx2;
+        }
+        if (cpuHasSse2())
+        {
+            return sse2;
+        }
+#endif
+        return hpiScalarKernels();
+    }
+
+    const HpiKernels& hpiKernels()
+    {
+        static const HpiKernels& kernels = selectKernels();
+        return kernels;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace rwe
+{
+    /**
+     * The byte-wise loops behind decrypt(), decryptInner() and computeChecksum().
+     * Every implementation produces exactly the same bytes as the scalar one,
+     * they differ only in the instruction set they need.
+     */
+    struct HpiKernels
+    {
+        const char* name;
+
+        /** out[i] = in[i] ^ key ^ (seed + i). in and out may be the same buffer. */
+        void (*decrypt)(unsigned char key, unsigned char seed, const char* in, char* out, std::size_t size);
+
+        /** buffer[i] = (buffer[i] - i) ^ i, with i taken mod 256. */
+        void (*decryptInner)(char* buffer, std::size_t size);
+
+        /** The sum of all bytes as unsigned values, mod 2^32. */
+        std::uint32_t (*checksum)(const char* buffer, std::size_t size);
+    };
+
+    /** The plain C++ kernels, available everywhere. */
+    const HpiKernels& hpiScalarKernels();
+
+    /** The fastest kernels the running CPU supports, chosen on first use. */
+    const HpiKernels& hpiKernels();
+}
@@ -1,8 +1,13 @@
 #include "hpi_util.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <vector>
 #include <zlib.h>
 #include "hpi_headers.h"
+#include "hpi_simd.h"
+#include "rwe/ThreadPool.h"
 
 namespace rwe
 {
@@ -23,10 +28,28 @@ namespace rwe
             return;
         }
 
-        for (std::streamsize i = 0; i < size; ++i)
+        if (size > 0)
         {
-            auto pos = seed + static_cast<unsigned char>(i);
-            buf[i] = (pos ^ key) ^ buf[i];
+            hpiKernels().decrypt(key, seed, buf, buf, static_cast<std::size_t>(size));
+        }
+    }
+
+    /**
+     * Decrypts size bytes from in into out, leaving the source untouched.
+     * This lets read-only (e.g. memory mapped) archive bytes be decrypted
+     * straight into their destination buffer.
+     */
+    void decrypt(unsigned char key, unsigned char seed, const char in[], char out[], std::streamsize size)
+    {
+        if (key == 0)
+        {
+            std::copy(in, in + size, out);
+            return;
+        }
+
+        if (size > 0)
+        {
+            hpiKernels().decrypt(key, seed, in, out, static_cast<std::size_t>(size));
         }
     }
 
@@ -45,31 +68,56 @@ namespace rwe
 
     void decryptInner(char* buffer, std::size_t size)
     {
-        for (std::size_t i = 0; i < size; ++i)
-        {
-            auto pos = static_cast<unsigned char>(i);
-            buffer[i] = (buffer[i] - pos) ^ pos;
-        }
+        hpiKernels().decryptInner(buffer, size);
     }
 
     uint32_t computeChecksum(const char* buffer, std::size_t size)
     {
-        uint32_t sum = 0;
-        for (std::size_t i = 0; i < size; ++i)
+        return hpiKernels().checksum(buffer, size);
+    }
+
+    /**
+     * Copies a back-reference of count bytes, starting distance bytes behind outPos, to outPos.
+     * Where the reference reaches back before the start of the output it refers to window
+     * slots that were never written, which read as zero.
+     */
+    static void copyMatch(char* out, std::size_t outPos, std::size_t distance, std::size_t count)
+    {
+        if (distance > outPos)
         {
-            sum += static_cast<unsigned char>(buffer[i]);
+            std::size_t zeros = std::min(distance - outPos, count);
+            std::fill(out + outPos, out + outPos + zeros, '\0');
+            outPos += zeros;
+            count -= zeros;
         }
 
-        return sum;
+        const char* src = out + outPos - distance;
+        char* dst = out + outPos;
+        if (distance >= count)
+        {
+            std::memcpy(dst, src, count);
+        }
+        else
+        {
+            // the match overlaps its own output, repeating the last distance bytes
+            for (std::size_t x = 0; x < count; ++x)
+            {
+                dst[x] = src[x];
+            }
+        }
     }
 
+    /**
+     * Decompresses a TA LZ77 stream.
+     * The format describes back-references as positions in a 4KiB ring buffer
+     * where output byte n lives at (n + 1) mod 4096. Rather than maintain that buffer,
+     * positions are translated into distances back from the current output position,
+     * and bytes are copied within the output itself.
+     */
     void decompressLZ77(const char* in, std::size_t len, char* out, std::size_t maxBytes)
     {
-        char window[4096];
-
         std::size_t inPos = 0;
         std::size_t outPos = 0;
-        unsigned int windowPos = 1;
 
         while (true)
         {
@@ -80,6 +128,15 @@ namespace rwe
 
             auto tag = static_cast<unsigned char>(in[inPos++]);
 
+            // eight literals in a row, with room for all of them, is the common case
+            if (tag == 0 && len - inPos >= 8 && maxBytes - outPos >= 8)
+            {
+                std::memcpy(out + outPos, in + inPos, 8);
+                inPos += 8;
+                outPos += 8;
+                continue;
+            }
+
             for (int i = 0; i < 8; ++i)
             {
                 if ((tag & 1) == 0) // next byte is a literal byte
@@ -94,10 +151,7 @@ namespace rwe
                         throw HpiException("LZ77 decompress ran over max output bytes");
                     }
 
-                    out[outPos++] = in[inPos];
-                    window[windowPos] = in[inPos];
-                    windowPos = (windowPos + 1) & 0xFFF;
-                    inPos++;
+                    out[outPos++] = in[inPos++];
                 }
                 else // next bytes point into the sliding window
                 {
@@ -106,7 +160,9 @@ namespace rwe
                         throw HpiException("LZ77 decompress expected window offset/length but got end of input");
                     }
 
-                    unsigned int packedData = *(reinterpret_cast<const uint16_t*>(&in[inPos]));
+                    unsigned int packedData =
+                        static_cast<unsigned char>(in[inPos]) |
+                        (static_cast<unsigned int>(static_cast<unsigned char>(in[inPos + 1])) << 8);
                     inPos += 2;
 
                     unsigned int offset = packedData >> 4;
@@ -123,13 +179,16 @@ namespace rwe
                         throw HpiException("LZ77 decompress ran over max output bytes");
                     }
 
-                    for (unsigned int x = 0; x < count; ++x)
+                    // offset is where the match starts in the ring buffer, the slot about to be written
+                    // (distance 0) still holds the byte written one full window ago
+                    std::size_t distance = (outPos + 1 - offset) & 0xFFF;
+                    if (distance == 0)
                     {
-                        out[outPos++] = window[offset];
-                        window[windowPos] = window[offset];
-                        offset = (offset + 1) & 0xFFF;
-                        windowPos = (windowPos + 1) & 0xFFF;
+                        distance = 4096;
                     }
+
+                    copyMatch(out, outPos, distance, count);
+                    outPos += count;
                 }
 
                 tag >>= 1;
@@ -184,6 +243,36 @@ namespace rwe
         return std::string::npos;
     }
 
+    /**
+     * Decompresses the (already decrypted) payload of a chunk into out,
+     * which must have room for chunkHeader.decompressedSize bytes.
+     */
+    static void decompressChunk(const HpiChunk& chunkHeader, const char* in, char* out)
+    {
+        switch (chunkHeader.compressionScheme)
+        {
+            case 0: // no compression
+                if (chunkHeader.compressedSize != chunkHeader.decompressedSize)
+                {
+                    throw HpiException("Uncompressed chunk has different decompressed and compressed sizes");
+                }
+
+                std::copy(in, in + chunkHeader.compressedSize, out);
+                break;
+
+            case 1: // LZ77 compression
+                decompressLZ77(in, chunkHeader.compressedSize, out, chunkHeader.decompressedSize);
+                break;
+
+            case 2: // ZLib compression
+                decompressZLib(in, chunkHeader.compressedSize, out, chunkHeader.decompressedSize);
+                break;
+
+            default:
+                throw HpiException("Invalid compression scheme");
+        }
+    }
+
     void extractCompressed(std::istream& stream, unsigned char decryptionKey, char* buffer, std::size_t size)
     {
         auto chunkCount = (size / 65536) + (size % 65536 == 0 ? 0 : 1);
@@ -219,29 +308,250 @@ namespace rwe
                 decryptInner(chunkBuffer.get(), chunkHeader.compressedSize);
             }
 
-            switch (chunkHeader.compressionScheme)
+            decompressChunk(chunkHeader, chunkBuffer.get(), buffer + bufferOffset);
+            bufferOffset += chunkHeader.decompressedSize;
+        }
+    }
+
+    /**
+     * Extracts a compressed file from the stream a chunk at a time,
+     * handing each decompressed chunk to visitor rather than keeping it.
+     */
+    void visitCompressed(std::istream& stream, unsigned char decryptionKey, std::size_t size, const std::function<void(const char*, std::size_t)>& visitor)
+    {
+        auto chunkCount = (size / 65536) + (size % 65536 == 0 ? 0 : 1);
+
+        auto chunkSizes = std::make_unique<uint32_t[]>(chunkCount);
+        readAndDecryptRawArray(stream, decryptionKey, chunkSizes.get(), chunkCount);
+
+        std::vector<char> chunkBuffer;
+        std::vector<char> outBuffer;
+        std::size_t bufferOffset = 0;
+        for (std::size_t i = 0; i < chunkCount; ++i)
+        {
+            auto chunkHeader = readAndDecryptRaw<HpiChunk>(stream, decryptionKey);
+            if (chunkHeader.marker != HpiChunkMagicNumber)
             {
-                case 0: // no compression
-                    if (chunkHeader.compressedSize != chunkHeader.decompressedSize)
-                    {
-                        throw HpiException("Uncompressed chunk has different decompressed and compressed sizes");
-                    }
+                throw HpiException("Invalid chunk header");
+            }
+
+            if (bufferOffset + chunkHeader.decompressedSize > size)
+            {
+                throw HpiException("Extracted file larger than expected");
+            }
+
+            chunkBuffer.resize(chunkHeader.compressedSize);
+            readAndDecrypt(stream, decryptionKey, chunkBuffer.data(), chunkHeader.compressedSize);
+
+            auto checksum = computeChecksum(chunkBuffer.data(), chunkHeader.compressedSize);
+            if (checksum != chunkHeader.checksum)
+            {
+                throw HpiException("Invalid chunk checksum");
+            }
+
+            if (chunkHeader.encrypted != 0)
+            {
+                decryptInner(chunkBuffer.data(), chunkHeader.compressedSize);
+            }
+
+            outBuffer.resize(chunkHeader.decompressedSize);
+            decompressChunk(chunkHeader, chunkBuffer.data(), outBuffer.data());
+            visitor(outBuffer.data(), outBuffer.size());
+            bufferOffset += chunkHeader.decompressedSize;
+        }
+    }
+
+    /** Where one chunk of a compressed file sits in the archive, and where it decompresses to. */
+    struct ChunkLocation
+    {
+        HpiChunk header;
+        std::size_t pos;        // of the chunk's payload, just past its header
+        std::size_t outOffset;  // in the decompressed file
+    };
+
+    /**
+     * Decrypts, verifies and decompresses one chunk straight out of the archive image.
+     * out receives the chunk's decompressed bytes.
+     * scratch is reused between calls to hold decrypted payloads.
+     */
+    static void extractChunk(const char* data, unsigned char decryptionKey, const ChunkLocation& chunk, char* out, std::vector<char>& scratch)
+    {
+        const HpiChunk& chunkHeader = chunk.header;
+        const char* chunkData = data + chunk.pos;
+        if (decryptionKey != 0 || chunkHeader.encrypted != 0)
+        {
+            scratch.resize(chunkHeader.compressedSize);
+            decrypt(decryptionKey, static_cast<unsigned char>(chunk.pos), chunkData, scratch.data(), chunkHeader.compressedSize);
+            chunkData = scratch.data();
+        }
+
+        auto checksum = computeChecksum(chunkData, chunkHeader.compressedSize);
+        if (checksum != chunkHeader.checksum)
+        {
+            throw HpiException("Invalid chunk checksum");
+        }
+
+        if (chunkHeader.encrypted != 0)
+        {
+            decryptInner(scratch.data(), chunkHeader.compressedSize);
+        }
+
+        decompressChunk(chunkHeader, chunkData, out);
+    }
+
+    /**
+     * Reads and validates the header of the chunk at pos, which decompresses to outOffset
+     * in a file of the given size, and advances pos to the next chunk.
+     */
+    static ChunkLocation nextChunk(const char* data, std::size_t dataSize, std::size_t& pos, unsigned char decryptionKey, std::size_t size, std::size_t outOffset)
+    {
+        auto chunkHeader = readAndDecryptRaw<HpiChunk>(data, dataSize, pos, decryptionKey);
+        pos += sizeof(HpiChunk);
+        if (chunkHeader.marker != HpiChunkMagicNumber)
+        {
+            throw HpiException("Invalid chunk header");
+        }
+
+        if (outOffset + chunkHeader.decompressedSize > size)
+        {
+            throw HpiException("Extracted file larger than expected");
+        }
+
+        if (chunkHeader.compressedSize > dataSize - pos)
+        {
+            throw HpiException("Runaway chunk data");
+        }
+
+        ChunkLocation chunk{ chunkHeader, pos, outOffset };
+        pos += chunkHeader.compressedSize;
+        return chunk;
+    }
+
+    /**
+     * Reads and validates the header of every chunk of a compressed file,
+     * without touching the chunk payloads.
+     */
+    static std::vector<ChunkLocation> locateChunks(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, std::size_t size)
+    {
+        auto chunkCount = (size / 65536) + (size % 65536 == 0 ? 0 : 1);
+
+        // the chunk size table is only needed to skip over, chunks follow one another
+        std::size_t pos = offset + chunkCount * sizeof(uint32_t);
+
+        std::vector<ChunkLocation> chunks;
+        chunks.reserve(chunkCount);
+        std::size_t bufferOffset = 0;
+        for (std::size_t i = 0; i < chunkCount; ++i)
+        {
+            chunks.push_back(nextChunk(data, dataSize, pos, decryptionKey, size, bufferOffset));
+            bufferOffset += chunks.back().header.decompressedSize;
+        }
+        return chunks;
+    }
 
-                    std::copy(chunkBuffer.get(), chunkBuffer.get() + chunkHeader.compressedSize, buffer + bufferOffset);
-                    bufferOffset += chunkHeader.decompressedSize;
-                    break;
-
-                case 1: // LZ77 compression
-                    decompressLZ77(chunkBuffer.get(), chunkHeader.compressedSize, buffer + bufferOffset, chunkHeader.decompressedSize);
-                    bufferOffset += chunkHeader.decompressedSize;
-                    break;
-
-                case 2: // ZLib compression
-                    decompressZLib(chunkBuffer.get(), chunkHeader.compressedSize, buffer + bufferOffset, chunkHeader.decompressedSize);
-                    bufferOffset += chunkHeader.decompressedSize;
-                    break;
-                default:
-                    throw HpiException("Invalid compression scheme");
+    /**
+     * Extracts a compressed file from an in-memory archive image.
+     * @param data The whole archive, e.g. a memory mapping of it.
+     * @param dataSize The size of the archive in bytes.
+     * @param offset The offset of the file's chunk size table.
+     * @param buffer Receives the decompressed file.
+     * @param size The decompressed size of the file.
+     *
+     * Chunks are decrypted straight out of the archive image. Unencrypted chunks
+     * are decompressed in place without being copied at all.
+     */
+    void extractCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, char* buffer, std::size_t size)
+    {
+        std::vector<char> scratch;
+        for (const ChunkLocation& chunk : locateChunks(data, dataSize, offset, decryptionKey, size))
+        {
+            extractChunk(data, decryptionKey, chunk, buffer + chunk.outOffset, scratch);
+        }
+    }
+
+    /**
+     * As above, but each decompressed chunk is handed to visitor in turn instead of being kept,
+     * so a file of any size is processed in one chunk's worth of memory.
+     */
+    void visitCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, std::size_t size, const std::function<void(const char*, std::size_t)>& visitor)
+    {
+        auto chunkCount = (size / 65536) + (size % 65536 == 0 ? 0 : 1);
+        std::size_t pos = offset + chunkCount * sizeof(uint32_t);
+
+        std::vector<char> scratch;
+        std::vector<char> outBuffer;
+        std::size_t bufferOffset = 0;
+        for (std::size_t i = 0; i < chunkCount; ++i)
+        {
+            ChunkLocation chunk = nextChunk(data, dataSize, pos, decryptionKey, size, bufferOffset);
+            outBuffer.resize(chunk.header.decompressedSize);
+            extractChunk(data, decryptionKey, chunk, outBuffer.data(), scratch);
+            visitor(outBuffer.data(), outBuffer.size());
+            bufferOffset += chunk.header.decompressedSize;
+        }
+    }
+
+    /**
+     * As above, but chunks are decompressed concurrently by pool's workers and the calling thread,
+     * each into its own slice of buffer. As with ThreadPool::forEach(), this is safe to call from a task
+     * already running on pool, and if several chunks are bad, the error thrown is that of the first.
+     */
+    void extractCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, char* buffer, std::size_t size, ThreadPool& pool)
+    {
+        std::vector<ChunkLocation> chunks = locateChunks(data, dataSize, offset, decryptionKey, size);
+        pool.forEach(chunks.size(), [&](std::size_t i)
+        {
+            // reused by each thread for all its chunks
+            thread_local std::vector<char> scratch;
+            extractChunk(data, decryptionKey, chunks[i], buffer + chunks[i].outOffset, scratch);
+        });
+    }
+
+    /**
+     * Extracts bytes [begin, begin + count) of a compressed file from an in-memory archive image.
+     * Only the chunks overlapping that range are decrypted and decompressed.
+     * Chunks wholly inside the range decompress straight into buffer, the partial ones at either end
+     * go through a temporary buffer.
+     */
+    void extractCompressedRange(
+        const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, std::size_t size,
+        std::size_t begin, char* buffer, std::size_t count)
+    {
+        if (begin > size || size - begin < count)
+        {
+            throw HpiException("Read past end of file");
+        }
+
+        std::size_t end = begin + count;
+        std::vector<char> scratch;
+        std::vector<char> partialChunk;
+        for (const ChunkLocation& chunk : locateChunks(data, dataSize, offset, decryptionKey, size))
+        {
+            std::size_t chunkBegin = chunk.outOffset;
+            std::size_t chunkEnd = chunk.outOffset + chunk.header.decompressedSize;
+            if (chunkEnd <= begin)
+            {
+                continue;
+            }
+            if (chunkBegin >= end)
+            {
+                break;
+            }
+
+            if (chunkBegin >= begin && chunkEnd <= end)
+            {
+                extractChunk(data, decryptionKey, chunk, buffer + (chunkBegin - begin), scratch);
+            }
+            else
+            {
+                partialChunk.resize(chunk.header.decompressedSize);
+                extractChunk(data, decryptionKey, chunk, partialChunk.data(), scratch);
+                std::size_t copyBegin = std::max(chunkBegin, begin);
+                std::size_t copyEnd = std::min(chunkEnd, end);
+                std::copy(
+                    partialChunk.data() + (copyBegin - chunkBegin),
+                    partialChunk.data() + (copyEnd - chunkBegin),
+                    buffer + (copyBegin - begin));
             }
         }
     }
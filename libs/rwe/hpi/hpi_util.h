@@ -1,9 +1,13 @@
 #pragma once
 #include <istream>
 #include <cstdint>
+#include <functional>
+#include <stdexcept>
 
 namespace rwe
 {
+    class ThreadPool;
+
     class HpiException : public std::runtime_error
     {
     public:
@@ -12,6 +16,8 @@ namespace rwe
 
     void decrypt(unsigned char key, unsigned char seed, char buf[], std::streamsize size);
 
+    void decrypt(unsigned char key, unsigned char seed, const char in[], char out[], std::streamsize size);
+
     void readAndDecrypt(std::istream& stream, unsigned char key, char buf[], std::streamsize size);
 
     unsigned char transformKey(unsigned char key);
@@ -28,6 +34,18 @@ namespace rwe
 
     void extractCompressed(std::istream& stream, unsigned char decryptionKey, char* buffer, std::size_t size);
 
+    void extractCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, char* buffer, std::size_t size);
+
+    void extractCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, char* buffer, std::size_t size, ThreadPool& pool);
+
+    void visitCompressed(std::istream& stream, unsigned char decryptionKey, std::size_t size, const std::function<void(const char*, std::size_t)>& visitor);
+
+    void visitCompressed(const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, std::size_t size, const std::function<void(const char*, std::size_t)>& visitor);
+
+    void extractCompressedRange(
+        const char* data, std::size_t dataSize, std::size_t offset, unsigned char decryptionKey, std::size_t size,
+        std::size_t begin, char* buffer, std::size_t count);
+
     template <typename T>
     T readAndDecryptRaw(std::istream& stream, unsigned char key)
     {
@@ -36,6 +54,19 @@ namespace rwe
         return val;
     }
 
+    template <typename T>
+    T readAndDecryptRaw(const char* data, std::size_t dataSize, std::size_t offset, unsigned char key)
+    {
+        if (offset > dataSize || dataSize - offset < sizeof(T))
+        {
+            throw HpiException("Read past end of archive");
+        }
+
+        T val;
+        decrypt(key, static_cast<unsigned char>(offset), data + offset, reinterpret_cast<char*>(&val), sizeof(T));
+        return val;
+    }
+
     template <typename T>
     void readAndDecryptRawArray(std::istream& stream, unsigned char key, T* buffer, std::size_t size)
     {
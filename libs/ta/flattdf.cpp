@@ -0,0 +1,382 @@
+#include "flattdf.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace ta;
+
+static const std::uint32_t FlatTdfMagicNumber = 0x46445446; // "FTDF"
+static const std::uint32_t FlatTdfVersion = 1;
+
+static char foldCase(char c)
+{
+    // as ci_less compares, in the C locale
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+static std::uint32_t hashFolded(std::string_view key)
+{
+    std::uint32_t hash = 2166136261u;
+    for (char c : key)
+    {
+        hash = (hash ^ static_cast<unsigned char>(foldCase(c))) * 16777619u;
+    }
+    return hash;
+}
+
+static bool equalFolded(std::string_view key, std::string_view folded)
+{
+    if (key.size() != folded.size())
+    {
+        return false;
+    }
+    for (std::size_t i = 0u; i < key.size(); ++i)
+    {
+        if (foldCase(key[i]) != folded[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace
+{
+    // the arrays of an image as they are gathered, before being laid out
+    struct FlatTdfBuilder
+    {
+        struct Node { std::uint32_t firstValue, valueCount, firstChild, childCount; };
+        struct Value { std::uint32_t key, offset, length; };
+        struct Child { std::uint32_t key, node; };
+
+        std::vector<Node> nodes;
+        std::vector<Value> values;
+        std::vector<Child> children;
+        std::vector<std::string> keys;
+        std::unordered_map<std::string, std::uint32_t> keyIds;
+        std::string strings;
+
+        std::uint32_t intern(const std::string& key)
+        {
+            std::string folded;
+            std::transform(key.begin(), key.end(), std::back_inserter(folded), foldCase);
+            auto it = keyIds.emplace(folded, static_cast<std::uint32_t>(keys.size())).first;
+            if (it->second == keys.size())
+            {
+                keys.push_back(folded);
+            }
+            return it->second;
+        }
+
+        std::uint32_t addNode(const TdfFile& tdf)
+        {
+            std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+            nodes.push_back(Node{
+                static_cast<std::uint32_t>(values.size()), static_cast<std::uint32_t>(tdf.values.size()),
+                static_cast<std::uint32_t>(children.size()), static_cast<std::uint32_t>(tdf.children.size()) });
+
+            for (const auto& p : tdf.values)
+            {
+                std::uint32_t offset = static_cast<std::uint32_t>(strings.size());
+                strings += p.second;
+                std::transform(p.second.begin(), p.second.end(), std::back_inserter(strings), ::tolower);
+                values.push_back(Value{ intern(p.first), offset, static_cast<std::uint32_t>(p.second.size()) });
+            }
+            std::sort(values.begin() + nodes[index].firstValue, values.end(), [](const Value& a, const Value& b) { return a.key < b.key; });
+
+            // claim this node's run of children before the children add runs of their own
+            std::uint32_t firstChild = nodes[index].firstChild;
+            children.resize(children.size() + tdf.children.size());
+            std::uint32_t n = firstChild;
+            for (const auto& p : tdf.children)
+            {
+                std::uint32_t key = intern(p.first);
+                std::uint32_t child = addNode(p.second);
+                children[n++] = Child{ key, child };
+            }
+            std::sort(children.begin() + firstChild, children.begin() + n, [](const Child& a, const Child& b) { return a.key < b.key; });
+
+            return index;
+        }
+    };
+
+    template <typename T>
+    void appendWords(std::vector<std::uint32_t>& words, const T* data, std::size_t count)
+    {
+        static_assert(sizeof(T) % sizeof(std::uint32_t) == 0, "records are whole words");
+        std::size_t at = words.size();
+        words.resize(at + count * sizeof(T) / sizeof(std::uint32_t));
+        if (count > 0u)
+        {
+            std::memcpy(&words[at], data, count * sizeof(T));
+        }
+    }
+}
+
+FlatTdfFile::Node::Node() :
+    file(nullptr),
+    index(NoIndex)
+{ }
+
+FlatTdfFile::Node::Node(const FlatTdfFile* file, std::uint32_t index) :
+    file(file),
+    index(index)
+{ }
+
+std::string_view FlatTdfFile::Node::getValueView(std::string_view key, std::string_view def) const
+{
+    const ValueRecord* value = file ? file->findValue(index, key) : nullptr;
+    if (value == nullptr)
+    {
+        return def;
+    }
+    return file->string(value->offset + value->length, value->length);
+}
+
+std::string FlatTdfFile::Node::getValue(std::string_view key, std::string_view def) const
+{
+    return std::string(getValueView(key, def));
+}
+
+std::string FlatTdfFile::Node::getValueOriginalCase(std::string_view key, std::string_view def) const
+{
+    const ValueRecord* value = file ? file->findValue(index, key) : nullptr;
+    if (value == nullptr)
+    {
+        return std::string(def);
+    }
+    return std::string(file->string(value->offset, value->length));
+}
+
+FlatTdfFile::Node FlatTdfFile::Node::getChild(std::string_view key) const
+{
+    if (file == nullptr)
+    {
+        return Node();
+    }
+    std::uint32_t child = file->findChild(index, key);
+    return child == NoIndex ? Node() : Node(file, child);
+}
+
+bool FlatTdfFile::Node::empty() const
+{
+    if (file == nullptr || index == NoIndex)
+    {
+        return true;
+    }
+    const NodeRecord& node = file->nodes[index];
+    return node.valueCount == 0u && node.childCount == 0u;
+}
+
+FlatTdfFile::FlatTdfFile() :
+    FlatTdfFile(TdfFile())
+{ }
+
+FlatTdfFile::FlatTdfFile(const TdfFile& tdf)
+{
+    FlatTdfBuilder builder;
+    builder.addNode(tdf);
+
+    // keep the hash at most half full, so there is always an empty slot to end a probe
+    std::uint32_t slotCount = 64u;
+    while (slotCount < builder.keys.size() * 2u)
+    {
+        slotCount *= 2u;
+    }
+    std::vector<std::uint32_t> slots(slotCount, 0u);
+    std::vector<KeyRecord> keyRecords;
+    for (std::uint32_t id = 0u; id < builder.keys.size(); ++id)
+    {
+        const std::string& key = builder.keys[id];
+        keyRecords.push_back(KeyRecord{ static_cast<std::uint32_t>(builder.strings.size()), static_cast<std::uint32_t>(key.size()) });
+        builder.strings += key;
+
+        std::uint32_t slot = hashFolded(key) & (slotCount - 1u);
+        while (slots[slot] != 0u)
+        {
+            slot = (slot + 1u) & (slotCount - 1u);
+        }
+        slots[slot] = id + 1u;
+    }
+
+    Header h = {
+        FlatTdfMagicNumber, FlatTdfVersion,
+        static_cast<std::uint32_t>(builder.nodes.size()), static_cast<std::uint32_t>(builder.values.size()),
+        static_cast<std::uint32_t>(builder.children.size()), static_cast<std::uint32_t>(keyRecords.size()),
+        slotCount, static_cast<std::uint32_t>(builder.strings.size())
+    };
+    builder.strings.resize((builder.strings.size() + 3u) & ~std::size_t(3u), '\0');
+
+    appendWords(storage, &h, 1u);
+    appendWords(storage, builder.nodes.data(), builder.nodes.size());
+    appendWords(storage, builder.values.data(), builder.values.size());
+    appendWords(storage, builder.children.data(), builder.children.size());
+    appendWords(storage, keyRecords.data(), keyRecords.size());
+    appendWords(storage, slots.data(), slots.size());
+    std::size_t at = storage.size();
+    storage.resize(at + builder.strings.size() / sizeof(std::uint32_t));
+    if (!builder.strings.empty())
+    {
+        std::memcpy(&storage[at], builder.strings.data(), builder.strings.size());
+    }
+
+    attach(reinterpret_cast<const char*>(storage.data()), storage.size() * sizeof(std::uint32_t));
+}
+
+FlatTdfFile::FlatTdfFile(const char* data, std::size_t size)
+{
+    attach(data, size);
+}
+
+void FlatTdfFile::attach(const char* data, std::size_t size)
+{
+    if (reinterpret_cast<std::uintptr_t>(data) % alignof(std::uint32_t) != 0u || size < sizeof(Header))
+    {
+        throw std::runtime_error("[FlatTdfFile] invalid image");
+    }
+    std::memcpy(&header, data, sizeof(Header));
+    if (header.magic != FlatTdfMagicNumber || header.version != FlatTdfVersion)
+    {
+        throw std::runtime_error("[FlatTdfFile] incompatible image");
+    }
+
+    std::uint64_t needed = sizeof(Header) +
+        std::uint64_t(header.nodeCount) * sizeof(NodeRecord) +
+        std::uint64_t(header.valueCount) * sizeof(ValueRecord) +
+        std::uint64_t(header.childCount) * sizeof(ChildRecord) +
+        std::uint64_t(header.keyCount) * sizeof(KeyRecord) +
+        std::uint64_t(header.keySlotCount) * sizeof(std::uint32_t) +
+        header.stringsSize;
+    if (needed > size || header.nodeCount == 0u ||
+        header.keySlotCount == 0u || (header.keySlotCount & (header.keySlotCount - 1u)) != 0u || header.keySlotCount <= header.keyCount)
+    {
+        throw std::runtime_error("[FlatTdfFile] corrupt image");
+    }
+
+    image = data;
+    imageSize = size;
+    const char* p = data + sizeof(Header);
+    nodes = reinterpret_cast<const NodeRecord*>(p);
+    p += header.nodeCount * sizeof(NodeRecord);
+    values = reinterpret_cast<const ValueRecord*>(p);
+    p += header.valueCount * sizeof(ValueRecord);
+    children = reinterpret_cast<const ChildRecord*>(p);
+    p += header.childCount * sizeof(ChildRecord);
+    keys = reinterpret_cast<const KeyRecord*>(p);
+    p += header.keyCount * sizeof(KeyRecord);
+    keySlots = reinterpret_cast<const std::uint32_t*>(p);
+    p += header.keySlotCount * sizeof(std::uint32_t);
+    strings = p;
+
+    // check every index once here, so lookups can follow them unchecked
+    auto inStrings = [this](std::uint64_t offset, std::uint64_t length) { return offset + length <= header.stringsSize; };
+    bool ok = true;
+    for (std::uint32_t n = 0u; ok && n < header.nodeCount; ++n)
+    {
+        ok = std::uint64_t(nodes[n].firstValue) + nodes[n].valueCount <= header.valueCount &&
+            std::uint64_t(nodes[n].firstChild) + nodes[n].childCount <= header.childCount;
+    }
+    for (std::uint32_t n = 0u; ok && n < header.valueCount; ++n)
+    {
+        ok = values[n].key < header.keyCount && inStrings(values[n].offset, 2u * std::uint64_t(values[n].length));
+    }
+    for (std::uint32_t n = 0u; ok && n < header.childCount; ++n)
+    {
+        ok = children[n].key < header.keyCount && children[n].node < header.nodeCount;
+    }
+    for (std::uint32_t n = 0u; ok && n < header.keyCount; ++n)
+    {
+        ok = inStrings(keys[n].offset, keys[n].length);
+    }
+    std::uint32_t usedSlots = 0u;
+    for (std::uint32_t n = 0u; ok && n < header.keySlotCount; ++n)
+    {
+        ok = keySlots[n] <= header.keyCount;
+        usedSlots += keySlots[n] != 0u ? 1u : 0u;
+    }
+    if (!ok || usedSlots > header.keyCount)
+    {
+        throw std::runtime_error("[FlatTdfFile] corrupt image");
+    }
+}
+
+FlatTdfFile::Node FlatTdfFile::root() const
+{
+    return Node(this, 0u);
+}
+
+std::string FlatTdfFile::getValue(std::string_view key, std::string_view def) const
+{
+    return root().getValue(key, def);
+}
+
+std::string FlatTdfFile::getValueOriginalCase(std::string_view key, std::string_view def) const
+{
+    return root().getValueOriginalCase(key, def);
+}
+
+FlatTdfFile::Node FlatTdfFile::getChild(std::string_view key) const
+{
+    return root().getChild(key);
+}
+
+std::size_t FlatTdfFile::nodeCount() const
+{
+    return header.nodeCount;
+}
+
+void FlatTdfFile::serialise(std::ostream& os) const
+{
+    os.write(image, imageSize);
+}
+
+std::string_view FlatTdfFile::string(std::uint32_t offset, std::uint32_t length) const
+{
+    return std::string_view(strings + offset, length);
+}
+
+std::uint32_t FlatTdfFile::findKey(std::string_view key) const
+{
+    std::uint32_t mask = header.keySlotCount - 1u;
+    for (std::uint32_t slot = hashFolded(key) & mask; keySlots[slot] != 0u; slot = (slot + 1u) & mask)
+    {
+        std::uint32_t id = keySlots[slot] - 1u;
+        if (equalFolded(key, string(keys[id].offset, keys[id].length)))
+        {
+            return id;
+        }
+    }
+    return NoIndex;
+}
+
+const FlatTdfFile::ValueRecord* FlatTdfFile::findValue(std::uint32_t node, std::string_view key) const
+{
+    std::uint32_t id = node == NoIndex ? NoIndex : findKey(key);
+    if (id == NoIndex)
+    {
+        return nullptr;
+    }
+
+    const ValueRecord* begin = values + nodes[node].firstValue;
+    const ValueRecord* end = begin + nodes[node].valueCount;
+    const ValueRecord* it = std::lower_bound(begin, end, id, [](const ValueRecord& v, std::uint32_t k) { return v.key < k; });
+    return it != end && it->key == id ? it : nullptr;
+}
+
+std::uint32_t FlatTdfFile::findChild(std::uint32_t node, std::string_view key) const
+{
+    std::uint32_t id = node == NoIndex ? NoIndex : findKey(key);
+    if (id == NoIndex)
+    {
+        return NoIndex;
+    }
+
+    const ChildRecord* begin = children + nodes[node].firstChild;
+    const ChildRecord* end = begin + nodes[node].childCount;
+    const ChildRecord* it = std::lower_bound(begin, end, id, [](const ChildRecord& c, std::uint32_t k) { return c.key < k; });
+    return it != end && it->key == id ? it->node : NoIndex;
+}
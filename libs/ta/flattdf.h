@@ -0,0 +1,133 @@
+#pragma once
+
+#include "tdf.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ta
+{
+
+    // A read-only TdfFile flattened into a few contiguous arrays.
+    // Keys are case folded and interned once, so a lookup hashes its key once and then
+    // binary searches integers, instead of case-insensitively comparing strings down a std::map at every level.
+    // getValue() and getChild() behave as TdfFile's do.
+    //
+    // The arrays together form one self-contained image. serialise() writes it out, and the image can then
+    // be used straight from memory, e.g. a memory mapped file, with nothing rebuilt on load.
+    // Images are native (little) endian, and only validated on load, never trusted.
+    class FlatTdfFile
+    {
+    public:
+        // a section of the file. Cheap to copy, and only valid while its FlatTdfFile lives
+        class Node
+        {
+        public:
+            Node();
+
+            std::string getValue(std::string_view key, std::string_view def) const;
+            std::string getValueOriginalCase(std::string_view key, std::string_view def) const;
+            Node getChild(std::string_view key) const;
+
+            // as getValue(), without copying. The view is into the FlatTdfFile
+            std::string_view getValueView(std::string_view key, std::string_view def) const;
+
+            bool empty() const;
+
+        private:
+            friend class FlatTdfFile;
+            Node(const FlatTdfFile* file, std::uint32_t index);
+
+            const FlatTdfFile* file;
+            std::uint32_t index;
+        };
+
+        FlatTdfFile();
+        explicit FlatTdfFile(const TdfFile& tdf);
+
+        // uses an image written by serialise() in place. data must be 4 byte aligned and outlive this.
+        // Throws std::runtime_error if it isn't a valid image
+        FlatTdfFile(const char* data, std::size_t size);
+
+        FlatTdfFile(const FlatTdfFile&) = delete;
+        FlatTdfFile& operator=(const FlatTdfFile&) = delete;
+
+        Node root() const;
+
+        std::string getValue(std::string_view key, std::string_view def) const;
+        std::string getValueOriginalCase(std::string_view key, std::string_view def) const;
+        Node getChild(std::string_view key) const;
+
+        std::size_t nodeCount() const;
+
+        void serialise(std::ostream& os) const;
+
+    private:
+        static const std::uint32_t NoIndex = 0xffffffffu;
+
+        struct Header
+        {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint32_t nodeCount;
+            std::uint32_t valueCount;
+            std::uint32_t childCount;
+            std::uint32_t keyCount;
+            std::uint32_t keySlotCount;
+            std::uint32_t stringsSize;
+        };
+
+        struct NodeRecord
+        {
+            std::uint32_t firstValue;
+            std::uint32_t valueCount;
+            std::uint32_t firstChild;
+            std::uint32_t childCount;
+        };
+
+        struct ValueRecord
+        {
+            std::uint32_t key;
+            std::uint32_t offset;   // into strings: the value as written, then again lower cased
+            std::uint32_t length;
+        };
+
+        struct ChildRecord
+        {
+            std::uint32_t key;
+            std::uint32_t node;
+        };
+
+        struct KeyRecord
+        {
+            std::uint32_t offset;   // into strings, case folded
+            std::uint32_t length;
+        };
+
+        // the image, when built here rather than handed in. Words, to keep the records aligned
+        std::vector<std::uint32_t> storage;
+
+        const char* image;
+        std::size_t imageSize;
+        Header header;
+
+        // these point into the image. Each node's run of values and of children is sorted by key
+        const NodeRecord* nodes;
+        const ValueRecord* values;
+        const ChildRecord* children;
+        const KeyRecord* keys;
+        const std::uint32_t* keySlots;  // open addressed hash of keys, holding index + 1
+        const char* strings;
+
+        void attach(const char* data, std::size_t size);
+        std::uint32_t findKey(std::string_view key) const;
+        std::string_view string(std::uint32_t offset, std::uint32_t length) const;
+
+        const ValueRecord* findValue(std::uint32_t node, std::string_view key) const;
+        std::uint32_t findChild(std::uint32_t node, std::string_view key) const;
+    };
+
+}
@@ -0,0 +1,252 @@
+#include "lazytdf.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+using namespace ta;
+
+static bool isSpace(char c)
+{
+    // as TdfFile trims
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static std::string_view trimView(std::string_view s)
+{
+    std::size_t begin = 0u;
+    while (begin < s.size() && isSpace(s[begin]))
+    {
+        ++begin;
+    }
+    std::size_t end = s.size();
+    while (end > begin && isSpace(s[end - 1]))
+    {
+        --end;
+    }
+    return s.substr(begin, end - begin);
+}
+
+// the next line from pos, cut at any "//" and trimmed, as TdfFile::tdfParse() reads them
+static std::string_view nextLine(std::string_view text, std::size_t& pos)
+{
+    std::string_view line;
+    std::size_t posNL = text.find('\n', pos);
+    if (posNL != std::string_view::npos)
+    {
+        line = text.substr(pos, posNL - pos);
+        pos = 1u + posNL;
+    }
+    else
+    {
+        line = text.substr(pos);
+        pos = text.size();
+    }
+
+    std::size_t posComment = line.find("//");
+    if (posComment != std::string_view::npos)
+    {
+        line = line.substr(0u, posComment);
+    }
+    return trimView(line);
+}
+
+static bool isHeading(std::string_view line)
+{
+    return line.size() > 2 && line.front() == '[' && line.back() == ']';
+}
+
+LazyTdfFile::LazyTdfFile() :
+    valuesParsed(true),
+    childrenListed(true)
+{ }
+
+LazyTdfFile::LazyTdfFile(const std::string &text, int maxDepth) :
+    valuesParsed(false),
+    childrenListed(false)
+{
+    auto newIndex = std::make_shared<Index>();
+    newIndex->text = text;
+
+    // as TdfFile(text, maxDepth), the root is parsed again for as long as there is text left
+    std::size_t pos = 0u;
+    do
+    {
+        std::uint32_t range = static_cast<std::uint32_t>(newIndex->ranges.size());
+        newIndex->ranges.push_back(Range{ pos, pos, {} });
+        pos = scan(*newIndex, range, pos, maxDepth);
+        newIndex->ranges[range].end = pos;
+        ranges.push_back(range);
+    }
+    while (pos < newIndex->text.size());
+
+    index = newIndex;
+}
+
+// TdfFile::tdfParse() line for line, but only noting where sections are
+std::size_t LazyTdfFile::scan(Index& index, std::uint32_t range, std::size_t pos, int maxDepth)
+{
+    std::string_view text(index.text);
+    int braceDepth = 0;
+
+    while (pos < text.size())
+    {
+        std::string_view line = nextLine(text, pos);
+        if (line.empty())
+        {
+            continue;
+        }
+
+        if (isHeading(line))
+        {
+            std::string subHeading(line.substr(1, line.size() - 2));
+            if (maxDepth > 0)
+            {
+                std::uint32_t child = static_cast<std::uint32_t>(index.ranges.size());
+                index.ranges.push_back(Range{ pos, pos, {} });
+                index.ranges[range].children.push_back(ChildRange{ subHeading, child });
+                pos = scan(index, child, pos, maxDepth - 1);
+                index.ranges[child].end = pos;
+            }
+            else
+            {
+                index.ranges[range].children.push_back(ChildRange{ subHeading, NoRange });
+                return text.size();
+            }
+        }
+        else if (line == "{")
+        {
+            ++braceDepth;
+        }
+        else if (line == "}")
+        {
+            --braceDepth;
+        }
+
+        if (braceDepth == 0)
+        {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+// TdfFile::tdfParse() line for line again, skipping over the child sections scan() found
+void LazyTdfFile::parseValues(const Index& index, std::uint32_t range, std::map<std::string, std::string, ci_less>& values)
+{
+    std::string_view text(index.text);
+    const Range& r = index.ranges[range];
+    auto child = r.children.begin();
+    std::size_t pos = r.begin;
+    int braceDepth = 0;
+
+    while (pos < text.size())
+    {
+        std::string_view line = nextLine(text, pos);
+        if (line.empty())
+        {
+            continue;
+        }
+
+        std::size_t posEquals = line.find('=');
+        if (isHeading(line))
+        {
+            if (child == r.children.end() || child->range == NoRange)
+            {
+                return;
+            }
+            pos = index.ranges[child->range].end;
+            ++child;
+        }
+        else if (line == "{")
+        {
+            ++braceDepth;
+        }
+        else if (line == "}")
+        {
+            --braceDepth;
+        }
+        else if (posEquals != std::string_view::npos)
+        {
+            std::string_view key = trimView(line.substr(0, posEquals));
+            std::string_view value = trimView(line.substr(posEquals + 1));
+            if (!value.empty() && value.back() == ';')
+            {
+                value.remove_suffix(1);
+            }
+            values[std::string(key)] = std::string(value);
+        }
+
+        if (braceDepth == 0)
+        {
+            return;
+        }
+    }
+}
+
+const std::map<std::string, std::string, ci_less>& LazyTdfFile::values() const
+{
+    if (!valuesParsed)
+    {
+        for (std::uint32_t range : ranges)
+        {
+            parseValues(*index, range, parsedValues);
+        }
+        valuesParsed = true;
+    }
+    return parsedValues;
+}
+
+const std::map<std::string, LazyTdfFile, ci_less>& LazyTdfFile::children() const
+{
+    if (!childrenListed)
+    {
+        for (std::uint32_t range : ranges)
+        {
+            for (const ChildRange& child : index->ranges[range].children)
+            {
+                if (child.range == NoRange)
+                {
+                    continue;
+                }
+
+                LazyTdfFile& section = listedChildren[child.name];
+                if (!section.index)
+                {
+                    section.index = index;
+                    section.valuesParsed = false;
+                    section.childrenListed = false;
+                }
+                section.ranges.push_back(child.range);
+            }
+        }
+        childrenListed = true;
+    }
+    return listedChildren;
+}
+
+std::string LazyTdfFile::getValue(const std::string& key, const std::string& def) const
+{
+    auto it = values().find(key);
+    if (it == values().end())
+    {
+        return def;
+    }
+
+    std::string lower;
+    std::transform(it->second.begin(), it->second.end(), std::back_inserter(lower), ::tolower);
+    return lower;
+}
+
+std::string LazyTdfFile::getValueOriginalCase(const std::string& key, const std::string& def) const
+{
+    auto it = values().find(key);
+    return it == values().end() ? def : it->second;
+}
+
+const LazyTdfFile& LazyTdfFile::getChild(const std::string& key) const
+{
+    static const LazyTdfFile emptyTdf;
+    auto it = children().find(key);
+    return it == children().end() ? emptyTdf : it->second;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "tdf.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ta
+{
+
+    // A TdfFile that parses on demand.
+    // Construction only scans the text for where each section starts and ends. A section's values are parsed
+    // the first time they're asked for, and its children are listed without being parsed,
+    // so sections that are never looked at cost no more than that scan.
+    // The result is exactly what TdfFile(text, maxDepth) gives.
+    // Reading parses, so a LazyTdfFile is not safe to share between threads, even read-only.
+    class LazyTdfFile
+    {
+    public:
+        LazyTdfFile();
+        LazyTdfFile(const std::string &text, int maxDepth);
+
+        const std::map<std::string, std::string, ci_less>& values() const;
+        const std::map<std::string, LazyTdfFile, ci_less>& children() const;
+
+        std::string getValue(const std::string& key, const std::string &def) const;
+        std::string getValueOriginalCase(const std::string& key, const std::string& def) const;
+        const LazyTdfFile& getChild(const std::string& key) const;
+
+    private:
+        static const std::uint32_t NoRange = 0xffffffffu;
+
+        struct ChildRange
+        {
+            std::string name;
+            std::uint32_t range;    // NoRange for a heading past maxDepth, where parsing stopped
+        };
+
+        // a stretch of the text that one TdfFile::tdfParse() call would parse into a section
+        struct Range
+        {
+            std::size_t begin;
+            std::size_t end;
+            std::vector<ChildRange> children;
+        };
+
+        struct Index
+        {
+            std::string text;
+            std::vector<Range> ranges;
+        };
+
+        std::shared_ptr<const Index> index;
+
+        // the ranges making up this section, in order. A heading given twice continues the same section
+        std::vector<std::uint32_t> ranges;
+
+        mutable bool valuesParsed;
+        mutable std::map<std::string, std::string, ci_less> parsedValues;
+        mutable bool childrenListed;
+        mutable std::map<std::string, LazyTdfFile, ci_less> listedChildren;
+
+        static std::size_t scan(Index& index, std::uint32_t range, std::size_t pos, int maxDepth);
+        static void parseValues(const Index& index, std::uint32_t range, std::map<std::string, std::string, ci_less>& values);
+    };
+
+}
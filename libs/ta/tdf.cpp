@@ -1,6 +1,7 @@
 #include "tdf.h"
+#include <algorithm>
+#include <iterator>
 #include <sstream>
-#include <regex>
 #include <cstdint>
 
 using namespace ta;
@@ -12,63 +13,55 @@ static std::string toLower(const std::string& s)
     return lower;
 }
 
-static std::string stripComments(const std::string &text)
+TdfFile::TdfFile()
+{ }
+
+static bool isSpace(char c)
 {
-    std::string result;
-    result.reserve(text.size());
+    // what a regex takes as \s
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
 
-    bool isComment = false;
-    for (std::size_t i = 0u; i < text.size(); ++i)
+static std::string_view trimView(std::string_view s)
+{
+    std::size_t begin = 0u;
+    while (begin < s.size() && isSpace(s[begin]))
     {
-        if (isComment && text[i] == '\n')
-        {
-            isComment = false;
-            result += '\n';
-        }
-        else if (!isComment && text[i] == '/' && i+1<text.size() && text[i+1] == '/')
-        {
-            isComment = true;
-        }
-        else if (!isComment)
-        {
-            result += text[i];
-        }
+        ++begin;
     }
-
-    return result;
-}
-
-static std::string trim(const std::string &s) {
-    static std::regex e("^\\s+|\\s+$");   // remove leading and trailing spaces. NB regex compilation very slow on mingw, so keep it static!
-    return std::regex_replace(s, e, "");
+    std::size_t end = s.size();
+    while (end > begin && isSpace(s[end - 1]))
+    {
+        --end;
+    }
+    return s.substr(begin, end - begin);
 }
 
-TdfFile::TdfFile()
-{ }
-
-TdfFile::TdfFile(const std::string &_text, int maxDepth)
+TdfFile::TdfFile(const std::string &text, int maxDepth)
 {
-    std::string text = stripComments(_text);
+    std::string_view view(text);
     std::size_t pos = 0u;
     do
     {
-        pos = tdfParse(text, pos, maxDepth);
+        pos = tdfParse(view, pos, maxDepth);
     }
-    while (pos < text.size());
+    while (pos < view.size());
 }
 
-std::size_t TdfFile::tdfParse(const std::string &text, std::size_t pos, int maxDepth)
+// Works line by line over the original text, with each line cut at any "//" and trimmed in place.
+// Only the headings, keys and values kept are copied. bench/tdfbench checks it against the regex based parser it replaced.
+std::size_t TdfFile::tdfParse(std::string_view text, std::size_t pos, int maxDepth)
 {
     int braceDepth = 0;
 
-    while(pos < text.size())
+    while (pos < text.size())
     {
-        std::string line;
-        std::size_t posNL = text.find_first_of('\n', pos);
-        if (posNL != std::string::npos)
+        std::string_view line;
+        std::size_t posNL = text.find('\n', pos);
+        if (posNL != std::string_view::npos)
         {
             line = text.substr(pos, posNL - pos);
-            pos = 1u+posNL;
+            pos = 1u + posNL;
         }
         else
         {
@@ -76,60 +69,55 @@ std::size_t TdfFile::tdfParse(const std::string &text, std::size_t pos, int maxD
             pos = text.size();
         }
 
-        line = trim(line);
+        std::size_t posComment = line.find("//");
+        if (posComment != std::string_view::npos)
+        {
+            line = line.substr(0u, posComment);
+        }
+
+        line = trimView(line);
         if (line.empty())
         {
-            //std::cout << "<empty line>" << std::endl;
             continue;
         }
-        //transform(line.begin(), line.end(), line.begin(), ::tolower);
-        //std::cout << line << std::endl;
 
-        std::size_t posEquals = line.find_first_of('=');
-        if (line.size()>2 && line.front() == '[' && line.back() == ']')
+        std::size_t posEquals = line.find('=');
+        if (line.size() > 2 && line.front() == '[' && line.back() == ']')
         {
             if (maxDepth > 0)
             {
-                std::string subHeading = line.substr(1, line.size() - 2);
-                //std::cout << "  <header>" << subHeading << std::endl;
+                std::string subHeading(line.substr(1, line.size() - 2));
                 pos = this->children[subHeading].tdfParse(text, pos, maxDepth - 1);
-                //std::cout << "  <header>" << subHeading << " resume pos=" << pos << std::endl;
             }
             else
             {
-                //std::cout << "  <header> maxDepth" << std::endl;
                 return text.size();
             }
         }
         else if (line == "{")
         {
             ++braceDepth;
-            //std::cout << "  <open brace> braceDepth=" << braceDepth << std::endl;
         }
         else if (line == "}")
         {
             --braceDepth;
-            //std::cout << "  <close brace> braceDepth=" << braceDepth << std::endl;
         }
-        else if (posEquals != std::string::npos)
+        else if (posEquals != std::string_view::npos)
         {
-            std::string key = trim(line.substr(0, posEquals));
-            std::string value = trim(line.substr(posEquals + 1));
-            //std::cout << "  <equals> key:" << key << ", val:" << value << std::endl;
-            if (value.back() == ';')
+            std::string_view key = trimView(line.substr(0, posEquals));
+            std::string_view value = trimView(line.substr(posEquals + 1));
+            if (!value.empty() && value.back() == ';')
             {
-                value = value.substr(0, value.size() - 1);
+                value.remove_suffix(1);
             }
-            this->values[key] = value;
+            this->values[std::string(key)] = std::string(value);
         }
 
         if (braceDepth == 0)
         {
-            //std::cout << "  <braceDepth=0> return pos=" << pos << std::endl;
             return pos;
         }
     }
-    //std::cout << "  <while break> return pos=" << pos << '/' << text.size() << std::endl;
     return pos;
 }
 
@@ -2,6 +2,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 
 namespace ta
 {
@@ -42,7 +43,7 @@ namespace ta
         void dumpjson(std::ostream& os, int indent=0) const;
 
     private:
-        std::size_t tdfParse(const std::string& text, std::size_t pos, int maxDepth);
+        std::size_t tdfParse(std::string_view text, std::size_t pos, int maxDepth);
     };
 
 }
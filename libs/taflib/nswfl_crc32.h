@@ -27,9 +27,13 @@ namespace taflib {
 
         void PartialCRC(unsigned int *iCRC, const unsigned char *sData, size_t iDataLength) const;
 
+        unsigned int Combine(unsigned int iCRCA, unsigned int iCRCB, size_t iLengthB) const;
+
     private:
         unsigned int Reflect(unsigned int iReflect, const char cChar);
-        unsigned int iTable[256]; // CRC lookup table array.
+        unsigned int MultiplyModP(unsigned int iA, unsigned int iB) const;
+        unsigned int iTable[8][256]; // CRC lookup table arrays, one per byte of a slicing-by-8 step.
+        unsigned int iPowers[32]; // x^(2^n) modulo the polynomial, for Combine().
     };
 
 } //namespace::NSWFL